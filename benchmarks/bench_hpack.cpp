@@ -0,0 +1,313 @@
+#include "hpack/hpack.hpp"
+#include "allocation_counter.hpp"
+#include "corpus.hpp"
+#include "perf_counters.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+using namespace hpack_bench;
+
+namespace {
+
+struct bench_result {
+  std::string name;
+  double ns = 0;
+  size_t connections = 0;
+  size_t blocks = 0;
+  size_t headers = 0;
+  size_t bytes = 0;
+  hpack_test::allocation_stats mallocs;
+  size_t pmr_allocations = 0;
+  perf_values perf;
+};
+
+// nullptr if hardware counters not requested (--perf)
+perf_counters* counters = nullptr;
+
+// counts between creation and .get()
+struct perf_scope {
+  perf_scope() noexcept {
+    if (counters)
+      counters->start();
+  }
+  perf_values get() noexcept {
+    return counters ? counters->stop() : perf_values{};
+  }
+};
+
+void print_header() {
+  std::printf("%-44s %10s %10s %12s %12s %12s %14s", "benchmark", "ns/header", "ns/byte", "allocs/hdr",
+              "allocs/block", "allocs/conn", "pmr allocs/hdr");
+  if (counters)
+    std::printf(" %12s %12s %12s %12s %12s %12s", "cycles/hdr", "cycles/byte", "instr/byte", "br-miss/hdr",
+                "cache-miss/hdr", "L1d-miss/hdr");
+  std::printf("\n");
+}
+
+void print_counter(double value, double per) {
+  if (value < 0)
+    std::printf(" %12s", "-");
+  else
+    std::printf(" %12.2f", value / per);
+}
+
+void print(const bench_result& r) {
+  double h = r.headers ? r.headers : 1;
+  double b = r.bytes ? r.bytes : 1;
+  double blocks = r.blocks ? r.blocks : 1;
+  double c = r.connections ? r.connections : 1;
+  std::printf("%-44s %10.1f %10.2f %12.3f %12.2f %12.1f %14.3f", r.name.c_str(), r.ns / h, r.ns / b,
+              r.mallocs.count / h, r.mallocs.count / blocks, r.mallocs.count / c, r.pmr_allocations / h);
+  if (counters) {
+    print_counter(r.perf.cycles, h);
+    print_counter(r.perf.cycles, b);
+    print_counter(r.perf.instructions, b);
+    print_counter(r.perf.branch_misses, h);
+    print_counter(r.perf.cache_misses, h);
+    print_counter(r.perf.l1d_misses, h);
+  }
+  std::printf("\n");
+}
+
+// runs 'connections' independent connections each replaying 'corpus',
+// 'f' called for each connection
+template <typename F>
+bench_result run(std::string name, size_t connections, const connection_corpus& corpus, F f) {
+  hpack_test::counting_resource resource;
+  bench_result r;
+  r.name = std::move(name);
+  r.connections = connections;
+  r.blocks = connections * corpus.size();
+  r.headers = connections * headers_count(corpus);
+  hpack_test::malloc_scope mallocs;
+  perf_scope perf;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < connections; ++i)
+    r.bytes += f(resource);
+  r.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  r.perf = perf.get();
+  r.mallocs = mallocs.get();
+  r.pmr_allocations = resource.allocated.count;
+  return r;
+}
+
+template <bool Cache, bool Huffman>
+std::vector<hpack::byte_t> encode_connection(const connection_corpus& corpus,
+                                             std::pmr::memory_resource* resource,
+                                             std::vector<size_t>* block_ends = nullptr) {
+  hpack::encoder enc(4096, resource);
+  std::vector<hpack::byte_t> bytes;
+  for (auto& block : corpus) {
+    hpack::encode_headers_block<Cache, Huffman>(enc, block, std::back_inserter(bytes));
+    if (block_ends)
+      block_ends->push_back(bytes.size());
+  }
+  return bytes;
+}
+
+template <bool Cache, bool Huffman>
+void bench_encode(const char* name, const connection_corpus& corpus, size_t connections) {
+  std::vector<hpack::byte_t> out;
+  print(run(name, connections, corpus, [&](std::pmr::memory_resource& resource) {
+    out.clear();
+    hpack::encoder enc(4096, &resource);
+    for (auto& block : corpus)
+      hpack::encode_headers_block<Cache, Huffman>(enc, block, std::back_inserter(out));
+    return out.size();
+  }));
+}
+
+template <bool Cache, bool Huffman>
+void bench_decode(const char* name, const connection_corpus& corpus, size_t connections) {
+  std::vector<size_t> ends;
+  auto bytes = encode_connection<Cache, Huffman>(corpus, std::pmr::new_delete_resource(), &ends);
+  print(run(name, connections, corpus, [&](std::pmr::memory_resource& resource) {
+    hpack::decoder dec(4096, &resource);
+    size_t begin = 0;
+    size_t sum = 0;
+    for (size_t end : ends) {
+      hpack::decode_headers_block(dec, std::span(bytes.data() + begin, end - begin),
+                                  [&](std::string_view n, std::string_view v) { sum += n.size() + v.size(); });
+      begin = end;
+    }
+    (void)sum;
+    return bytes.size();
+  }));
+}
+
+template <bool Cache, bool Huffman>
+void bench_decode_interleaved(const char* name, const connection_corpus& corpus, size_t connections) {
+  std::vector<size_t> ends;
+  auto bytes = encode_connection<Cache, Huffman>(corpus, std::pmr::new_delete_resource(), &ends);
+  hpack::block_decode_buffers buf;
+  print(run(name, connections, corpus, [&](std::pmr::memory_resource& resource) {
+    hpack::decoder dec(4096, &resource);
+    size_t begin = 0;
+    size_t sum = 0;
+    for (size_t end : ends) {
+      hpack::decode_headers_block_interleaved(
+          dec, std::span(bytes.data() + begin, end - begin), buf,
+          [&](std::string_view n, std::string_view v) { sum += n.size() + v.size(); });
+      begin = end;
+    }
+    (void)sum;
+    return bytes.size();
+  }));
+}
+
+// one huge block (cookies, tracing baggage), decoded 'repeats' times by fresh decoders
+void bench_huge_block(size_t repeats) {
+  std::mt19937 gen(7);
+  std::vector<hpack::byte_t> bytes;
+  hpack::encoder enc;
+  size_t headers = 0;
+  while (bytes.size() < 256 * 1024) {
+    std::string value = noexport::random_hex(256 + gen() % 2048, gen);
+    enc.encode<false, true>("cookie", value, std::back_inserter(bytes));
+    ++headers;
+  }
+  auto measure = [&](const char* name, auto decode_one) {
+    bench_result r;
+    r.name = name;
+    r.connections = r.blocks = repeats;
+    r.headers = headers * repeats;
+    r.bytes = bytes.size() * repeats;
+    hpack_test::malloc_scope mallocs;
+    perf_scope perf;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; ++i) {
+      hpack::decoder dec;
+      decode_one(dec);
+    }
+    r.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    r.perf = perf.get();
+    r.mallocs = mallocs.get();
+    print(r);
+  };
+  auto ignore = [](std::string_view, std::string_view) {};
+  hpack::block_decode_buffers buf;
+  measure("decode huge block", [&](hpack::decoder& dec) { hpack::decode_headers_block(dec, bytes, ignore); });
+  measure("decode huge block interleaved", [&](hpack::decoder& dec) {
+    hpack::decode_headers_block_interleaved(dec, bytes, buf, ignore);
+  });
+  measure("decode huge block parallel", [&](hpack::decoder& dec) {
+    hpack::decode_headers_block_parallel(dec, bytes, buf, hpack::thread_parallel_for{}, ignore);
+  });
+}
+
+// many connections with big tables (do not fit in cache together),
+// each round decodes next block of every connection, like event loop with many ready connections
+void bench_decode_batch(size_t connections, size_t blocks) {
+  const size_t warmup_blocks = blocks / 2;
+  std::vector<std::vector<hpack::byte_t>> bytes(connections);
+  std::vector<std::vector<size_t>> ends(connections);
+  size_t headers = 0;
+  size_t total_bytes = 0;
+  for (size_t c = 0; c < connections; ++c) {
+    connection_corpus corpus = make_request_corpus(blocks, c);
+    hpack::encoder enc(64 * 1024);
+    for (size_t b = 0; b < blocks; ++b) {
+      hpack::encode_headers_block<true, false>(enc, corpus[b], std::back_inserter(bytes[c]));
+      ends[c].push_back(bytes[c].size());
+      if (b >= warmup_blocks) {
+        headers += corpus[b].size();
+        total_bytes += ends[c][b] - ends[c][b - 1];
+      }
+    }
+  }
+  auto block = [&](size_t c, size_t b) {
+    size_t begin = b ? ends[c][b - 1] : 0;
+    return std::span<const hpack::byte_t>(bytes[c].data() + begin, ends[c][b] - begin);
+  };
+  auto measure = [&](const char* name, auto decode_round) {
+    std::vector<hpack::decoder> decoders;
+    for (size_t c = 0; c < connections; ++c)
+      decoders.emplace_back(64 * 1024);
+    auto ignore = [](std::string_view, std::string_view) {};
+    for (size_t b = 0; b < warmup_blocks; ++b)
+      for (size_t c = 0; c < connections; ++c)
+        hpack::decode_headers_block(decoders[c], block(c, b), ignore);
+    bench_result r;
+    r.name = name;
+    r.connections = connections;
+    r.blocks = connections * (blocks - warmup_blocks);
+    r.headers = headers;
+    r.bytes = total_bytes;
+    hpack_test::malloc_scope mallocs;
+    perf_scope perf;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t b = warmup_blocks; b < blocks; ++b)
+      decode_round(decoders, b);
+    r.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    r.perf = perf.get();
+    r.mallocs = mallocs.get();
+    print(r);
+  };
+  size_t sum = 0;
+  measure("decode many connections one by one", [&](std::vector<hpack::decoder>& decoders, size_t b) {
+    for (size_t c = 0; c < connections; ++c)
+      hpack::decode_headers_block(decoders[c], block(c, b),
+                                  [&](std::string_view n, std::string_view v) { sum += n.size() + v.size(); });
+  });
+  std::vector<hpack::batch_decode_item> items(connections);
+  measure("decode many connections batch", [&](std::vector<hpack::decoder>& decoders, size_t b) {
+    for (size_t c = 0; c < connections; ++c)
+      items[c] = {.dec = &decoders[c], .bytes = block(c, b)};
+    hpack::decode_headers_blocks_batch(
+        items, [&](size_t, std::string_view n, std::string_view v) { sum += n.size() + v.size(); });
+  });
+  (void)sum;
+}
+
+}  // namespace
+
+// usage: bench_hpack [--perf]
+//   --perf - collect hardware counters (linux perf_event_open, may require
+//            kernel.perf_event_paranoid <= 2)
+int main(int argc, char** argv) {
+  std::unique_ptr<perf_counters> perf;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--perf") == 0) {
+      perf = std::make_unique<perf_counters>();
+    } else {
+      std::printf("usage: %s [--perf]\n", argv[0]);
+      return 1;
+    }
+  }
+  std::string model = cpu_model();
+  std::string governor = cpu_governor();
+  std::printf("cpu: %s, governor: %s\n", model.empty() ? "unknown" : model.c_str(),
+              governor.empty() ? "unknown" : governor.c_str());
+  if (perf) {
+    if (perf->available())
+      counters = perf.get();
+    else
+      std::printf("hardware counters not available: %s\n", perf->open_error().c_str());
+  }
+
+  const size_t connections = 200;
+  const connection_corpus requests = make_request_corpus(100);
+  const connection_corpus responses = make_response_corpus(100);
+
+  if (!hpack_test::malloc_counting_supported())
+    std::printf("malloc counting not supported on this platform, only pmr allocations counted\n");
+  print_header();
+  bench_encode<false, false>("encode requests", requests, connections);
+  bench_encode<true, false>("encode requests cache", requests, connections);
+  bench_encode<true, true>("encode requests cache huffman", requests, connections);
+  bench_encode<true, true>("encode responses cache huffman", responses, connections);
+  bench_decode<false, false>("decode requests", requests, connections);
+  bench_decode<false, true>("decode requests huffman", requests, connections);
+  bench_decode<true, false>("decode requests cache", requests, connections);
+  bench_decode<true, true>("decode requests cache huffman", requests, connections);
+  bench_decode<true, true>("decode responses cache huffman", responses, connections);
+  bench_decode_interleaved<false, true>("decode interleaved requests huffman", requests, connections);
+  bench_decode_interleaved<true, true>("decode interleaved requests cache huffman", requests, connections);
+  bench_decode_interleaved<true, true>("decode interleaved responses cache huffman", responses, connections);
+  bench_huge_block(50);
+  bench_decode_batch(512, 100);
+}
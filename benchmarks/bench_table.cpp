@@ -0,0 +1,126 @@
+// dynamic table scaling: cost per operation for table sizes from 4 KB to 1 MB
+// and different distributions of entry sizes
+#include "hpack/dynamic_table.hpp"
+#include "corpus.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace hpack_bench;
+
+namespace {
+
+struct entry_distribution {
+  const char* name;
+  size_t min_name;
+  size_t max_name;
+  size_t min_value;
+  size_t max_value;
+};
+
+constexpr entry_distribution distributions[] = {
+    {"small", 4, 16, 1, 32},
+    {"medium", 8, 24, 32, 256},
+    {"large", 8, 24, 256, 2048},  // tracing baggage, cookies
+};
+
+using entries_t = std::vector<std::pair<std::string, std::string>>;
+
+entries_t make_entries(const entry_distribution& d, size_t count, std::mt19937& gen) {
+  entries_t entries;
+  entries.reserve(count);
+  auto len = [&](size_t min, size_t max) { return min + gen() % (max - min + 1); };
+  for (size_t i = 0; i < count; ++i) {
+    entries.emplace_back("x-" + noexport::random_hex(len(d.min_name, d.max_name), gen),
+                         noexport::random_hex(len(d.min_value, d.max_value), gen));
+  }
+  return entries;
+}
+
+template <typename F>
+double ns_per_op(size_t ops, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ops ? ns / ops : 0;
+}
+
+// result of compiler-opaque operations, prevents optimizing out
+size_t sink = 0;
+
+// Table - hpack::dynamic_table_t (encoder) or hpack::decoder_dynamic_table_t (index only)
+template <typename Table>
+void bench(const char* kind, hpack::size_type table_size, const entry_distribution& d) {
+  std::mt19937 gen(table_size);
+  // enough entries to fill table several times
+  const size_t avg_entry = 32 + (d.min_name + d.max_name + d.min_value + d.max_value) / 2 + 2;
+  const size_t count = std::max<size_t>(4 * table_size / avg_entry, 1000);
+  const entries_t entries = make_entries(d, count, gen);
+  Table table(table_size);
+
+  // add into empty table until full
+  size_t filled = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (; filled < entries.size(); ++filled) {
+    auto& [n, v] = entries[filled];
+    if (table.current_size() + n.size() + v.size() + 32 > table.max_size())
+      break;
+    table.add_entry(n, v);
+  }
+  const double add_ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / filled;
+  const size_t entries_in_table = table.current_max_index() - hpack::static_table_t::first_unused_index + 1;
+
+  // add into full table, each add evicts oldest entries
+  const size_t evicting_adds = entries.size() - filled;
+  double add_evict_ns = ns_per_op(evicting_adds, [&] {
+    for (size_t i = filled; i < entries.size(); ++i)
+      table.add_entry(entries[i].first, entries[i].second);
+  });
+  const size_t in_table = table.current_max_index() - hpack::static_table_t::first_unused_index + 1;
+
+  // find entries present in table (last added) and absent ones
+  const size_t lookups = 100'000;
+  // linear scan in decoder table
+  const size_t find_lookups = std::is_same_v<Table, hpack::dynamic_table_t> ? lookups : 1'000;
+  double find_hit_ns = ns_per_op(find_lookups, [&] {
+    for (size_t i = 0; i < find_lookups; ++i) {
+      auto& [n, v] = entries[entries.size() - 1 - gen() % in_table];
+      sink += table.find(n, v).header_name_index;
+    }
+  });
+  double find_miss_ns = ns_per_op(find_lookups, [&] {
+    for (size_t i = 0; i < find_lookups; ++i) {
+      auto& [n, v] = entries[gen() % (entries.size() - in_table)];
+      sink += table.find(n, v).header_name_index;
+    }
+  });
+  double get_ns = ns_per_op(lookups, [&] {
+    for (size_t i = 0; i < lookups; ++i)
+      sink += table.get_entry(hpack::static_table_t::first_unused_index + gen() % in_table).value.size();
+  });
+
+  // evict whole table by size update
+  double evict_ns = ns_per_op(in_table, [&] { table.update_size(0); });
+
+  std::printf("%-8s %9u %-8s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", kind, unsigned(table_size),
+              d.name, entries_in_table, add_ns, add_evict_ns, find_hit_ns, find_miss_ns, get_ns, evict_ns);
+}
+
+}  // namespace
+
+int main() {
+  std::printf("ns per operation\n");
+  std::printf("%-8s %9s %-8s %8s %10s %10s %10s %10s %10s %10s\n", "kind", "table", "entries", "count", "add",
+              "add+evict", "find hit", "find miss", "get_entry", "evict");
+  for (const entry_distribution& d : distributions) {
+    for (hpack::size_type size = 4 * 1024; size <= 1024 * 1024; size *= 4) {
+      bench<hpack::dynamic_table_t>("encoder", size, d);
+      bench<hpack::decoder_dynamic_table_t>("decoder", size, d);
+    }
+  }
+  (void)sink;
+}
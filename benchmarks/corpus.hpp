@@ -0,0 +1,101 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hpack_bench {
+
+using header_list = std::vector<std::pair<std::string, std::string>>;
+
+// sequence of header blocks sent over one connection
+using connection_corpus = std::vector<header_list>;
+
+namespace noexport {
+
+inline std::string random_hex(size_t len, std::mt19937& gen) {
+  constexpr std::string_view digits = "0123456789abcdef";
+  std::string s(len, '0');
+  for (char& c : s)
+    c = digits[gen() % digits.size()];
+  return s;
+}
+
+inline std::string random_path(std::mt19937& gen) {
+  constexpr std::string_view parts[] = {"api", "v1", "v2", "users", "items", "static", "img", "search"};
+  std::string path;
+  size_t n = 1 + gen() % 4;
+  for (size_t i = 0; i < n; ++i) {
+    path += '/';
+    path += parts[gen() % std::size(parts)];
+  }
+  if (gen() % 2)
+    path += "/" + std::to_string(gen() % 100000);
+  return path;
+}
+
+}  // namespace noexport
+
+// browser-like requests: stable pseudoheaders, user-agent, cookies,
+// changing paths and per-request ids
+inline connection_corpus make_request_corpus(size_t blocks, uint32_t seed = 42) {
+  using namespace noexport;
+  std::mt19937 gen(seed);
+  const std::string authority = "www." + random_hex(8, gen) + ".com";
+  const std::string cookie = "session=" + random_hex(32, gen) + "; theme=dark; lang=en-US";
+  connection_corpus corpus;
+  corpus.reserve(blocks);
+  for (size_t i = 0; i < blocks; ++i) {
+    header_list& h = corpus.emplace_back();
+    bool post = gen() % 5 == 0;
+    h.emplace_back(":method", post ? "POST" : "GET");
+    h.emplace_back(":scheme", "https");
+    h.emplace_back(":authority", authority);
+    h.emplace_back(":path", random_path(gen));
+    h.emplace_back("user-agent",
+                   "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                   "Chrome/124.0.0.0 Safari/537.36");
+    h.emplace_back("accept", post ? "application/json" : "text/html,application/xhtml+xml,*/*;q=0.8");
+    h.emplace_back("accept-encoding", "gzip, deflate, br");
+    h.emplace_back("accept-language", "en-US,en;q=0.9");
+    h.emplace_back("cookie", cookie);
+    if (post) {
+      h.emplace_back("content-type", "application/json");
+      h.emplace_back("content-length", std::to_string(gen() % 4096));
+    }
+    h.emplace_back("x-request-id", random_hex(32, gen));
+  }
+  return corpus;
+}
+
+// typical responses: status, date, content headers, caching, tracing
+inline connection_corpus make_response_corpus(size_t blocks, uint32_t seed = 42) {
+  using namespace noexport;
+  std::mt19937 gen(seed);
+  constexpr std::string_view statuses[] = {"200", "200", "200", "204", "304", "404"};
+  connection_corpus corpus;
+  corpus.reserve(blocks);
+  for (size_t i = 0; i < blocks; ++i) {
+    header_list& h = corpus.emplace_back();
+    h.emplace_back(":status", statuses[gen() % std::size(statuses)]);
+    h.emplace_back("server", "nginx/1.18.0");
+    h.emplace_back("date", "Fri, 06 Sep 2024 07:08:" + std::to_string(10 + i % 50) + " GMT");
+    h.emplace_back("content-type", "application/json");
+    h.emplace_back("content-length", std::to_string(gen() % 100000));
+    h.emplace_back("cache-control", "private, max-age=0");
+    h.emplace_back("strict-transport-security", "max-age=31536000; includeSubDomains; preload");
+    h.emplace_back("vary", "accept-encoding");
+    h.emplace_back("x-trace-id", random_hex(32, gen));
+  }
+  return corpus;
+}
+
+inline size_t headers_count(const connection_corpus& c) {
+  size_t n = 0;
+  for (auto& block : c)
+    n += block.size();
+  return n;
+}
+
+}  // namespace hpack_bench
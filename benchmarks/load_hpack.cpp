@@ -0,0 +1,306 @@
+// end-to-end load harness: in-process clients and servers connected by socketpairs
+// exchange HEADERS frames (encoded by 'encoder', decoded by 'decoder') over many connections and threads.
+// Linux only, runs offline
+#include "hpack/hpack.hpp"
+// only counting_resource, malloc of all threads must not contend on counters
+#define HPACK_TEST_NO_MALLOC_INTERPOSE
+#include "allocation_counter.hpp"
+#include "corpus.hpp"
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hpack_bench;
+
+namespace {
+
+struct options {
+  size_t connections = 64;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t blocks = 200;
+  size_t table_size = 4096;
+  bool huffman = true;
+  bool cache = true;
+};
+
+[[noreturn]] void fail(const char* what) {
+  std::perror(what);
+  std::exit(2);
+}
+
+void write_all(int fd, const hpack::byte_t* data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0)
+      fail("write");
+    data += n;
+    len -= n;
+  }
+}
+
+void read_all(int fd, hpack::byte_t* data, size_t len) {
+  while (len) {
+    ssize_t n = read(fd, data, len);
+    if (n <= 0)
+      fail("read");
+    data += n;
+    len -= n;
+  }
+}
+
+// HTTP/2 frame header (RFC 9113 4.1) + payload
+void send_headers_frame(int fd, uint32_t stream_id, std::vector<hpack::byte_t>& frame) {
+  // 9 bytes reserved for header by caller
+  uint32_t len = frame.size() - 9;
+  hpack::byte_t header[9] = {
+      hpack::byte_t(len >> 16), hpack::byte_t(len >> 8), hpack::byte_t(len),
+      0x1,  // HEADERS
+      0x5,  // END_STREAM | END_HEADERS
+      hpack::byte_t(stream_id >> 24), hpack::byte_t(stream_id >> 16), hpack::byte_t(stream_id >> 8),
+      hpack::byte_t(stream_id),
+  };
+  std::copy_n(header, 9, frame.begin());
+  write_all(fd, frame.data(), frame.size());
+}
+
+// returns payload of HEADERS frame in 'buf'
+std::span<const hpack::byte_t> read_headers_frame(int fd, std::vector<hpack::byte_t>& buf) {
+  hpack::byte_t header[9];
+  read_all(fd, header, 9);
+  size_t len = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+  if (header[3] != 0x1) {
+    std::fprintf(stderr, "unexpected frame type %d\n", int(header[3]));
+    std::exit(2);
+  }
+  buf.resize(len);
+  read_all(fd, buf.data(), len);
+  return buf;
+}
+
+struct connection {
+  int client_fd = -1;
+  int server_fd = -1;
+  connection_corpus requests;
+  connection_corpus responses;
+};
+
+void encode_block(const options& opts, hpack::encoder& enc, const header_list& headers,
+                  std::vector<hpack::byte_t>& out) {
+  out.resize(9);
+  auto it = std::back_inserter(out);
+  if (opts.cache && opts.huffman)
+    hpack::encode_headers_block<true, true>(enc, headers, it);
+  else if (opts.cache)
+    hpack::encode_headers_block<true, false>(enc, headers, it);
+  else if (opts.huffman)
+    hpack::encode_headers_block<false, true>(enc, headers, it);
+  else
+    hpack::encode_headers_block<false, false>(enc, headers, it);
+}
+
+// each thread owns its connections and their encoders / decoders
+struct thread_stats {
+  // round latency: from start of encoding request until its response decoded,
+  // includes waiting for other connections of thread in same round (requests are pipelined)
+  std::vector<uint32_t> latencies_ns;
+  size_t headers = 0;
+  size_t bytes = 0;
+  size_t table_bytes_peak = 0;
+};
+
+// sends all requests of its connections round by round, waits for responses
+void client_thread(const options& opts, std::span<connection> conns, thread_stats& stats) {
+  hpack_test::counting_resource resource;
+  std::vector<hpack::encoder> encoders;
+  std::vector<hpack::decoder> decoders;
+  for (size_t i = 0; i < conns.size(); ++i) {
+    encoders.emplace_back(opts.table_size, &resource);
+    decoders.emplace_back(opts.table_size, &resource);
+  }
+  std::vector<std::chrono::steady_clock::time_point> sent(conns.size());
+  std::vector<hpack::byte_t> frame;
+  size_t checksum = 0;
+  for (size_t b = 0; b < opts.blocks; ++b) {
+    uint32_t stream_id = 1 + 2 * b;
+    for (size_t c = 0; c < conns.size(); ++c) {
+      sent[c] = std::chrono::steady_clock::now();
+      encode_block(opts, encoders[c], conns[c].requests[b], frame);
+      stats.bytes += frame.size() - 9;
+      stats.headers += conns[c].requests[b].size();
+      send_headers_frame(conns[c].client_fd, stream_id, frame);
+    }
+    for (size_t c = 0; c < conns.size(); ++c) {
+      auto payload = read_headers_frame(conns[c].client_fd, frame);
+      stats.bytes += payload.size();
+      hpack::decode_headers_block(decoders[c], payload, [&](std::string_view n, std::string_view v) {
+        checksum += n.size() + v.size();
+        ++stats.headers;
+      });
+      stats.latencies_ns.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent[c])
+              .count());
+    }
+  }
+  (void)checksum;
+  stats.table_bytes_peak = resource.peak_bytes_in_use;
+}
+
+// answers each request with next response of corpus
+void server_thread(const options& opts, std::span<connection> conns, thread_stats& stats) {
+  hpack_test::counting_resource resource;
+  std::vector<hpack::encoder> encoders;
+  std::vector<hpack::decoder> decoders;
+  for (size_t i = 0; i < conns.size(); ++i) {
+    encoders.emplace_back(opts.table_size, &resource);
+    decoders.emplace_back(opts.table_size, &resource);
+  }
+  std::vector<hpack::byte_t> in;
+  std::vector<hpack::byte_t> out;
+  size_t checksum = 0;
+  for (size_t b = 0; b < opts.blocks; ++b) {
+    uint32_t stream_id = 1 + 2 * b;
+    for (size_t c = 0; c < conns.size(); ++c) {
+      auto payload = read_headers_frame(conns[c].server_fd, in);
+      hpack::decode_headers_block(decoders[c], payload, [&](std::string_view n, std::string_view v) {
+        checksum += n.size() + v.size();
+      });
+      encode_block(opts, encoders[c], conns[c].responses[b], out);
+      send_headers_frame(conns[c].server_fd, stream_id, out);
+    }
+  }
+  (void)checksum;
+  stats.table_bytes_peak = resource.peak_bytes_in_use;
+}
+
+double cpu_seconds() {
+  rusage u;
+  getrusage(RUSAGE_SELF, &u);
+  return u.ru_utime.tv_sec + u.ru_stime.tv_sec + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+}
+
+// resident set size in bytes, 0 if unknown
+size_t rss_bytes() {
+  std::ifstream f("/proc/self/statm");
+  size_t pages = 0;
+  size_t resident = 0;
+  f >> pages >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+bool parse_args(int argc, char** argv, options& opts) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&]() -> size_t {
+      if (i + 1 == argc)
+        return 0;
+      return std::strtoull(argv[++i], nullptr, 10);
+    };
+    if (arg == "--connections")
+      opts.connections = value();
+    else if (arg == "--threads")
+      opts.threads = value();
+    else if (arg == "--blocks")
+      opts.blocks = value();
+    else if (arg == "--table-size")
+      opts.table_size = value();
+    else if (arg == "--no-huffman")
+      opts.huffman = false;
+    else if (arg == "--no-cache")
+      opts.cache = false;
+    else
+      return false;
+  }
+  return opts.connections && opts.threads && opts.blocks;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  options opts;
+  if (!parse_args(argc, argv, opts)) {
+    std::printf(
+        "usage: %s [--connections N] [--threads N] [--blocks N] [--table-size N] [--no-huffman] "
+        "[--no-cache]\n",
+        argv[0]);
+    return 1;
+  }
+  opts.threads = std::min(opts.threads, opts.connections);
+
+  const size_t rss_before = rss_bytes();
+  std::vector<connection> conns(opts.connections);
+  for (size_t i = 0; i < conns.size(); ++i) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      fail("socketpair");
+    conns[i].client_fd = fds[0];
+    conns[i].server_fd = fds[1];
+    conns[i].requests = make_request_corpus(opts.blocks, i);
+    conns[i].responses = make_response_corpus(opts.blocks, i);
+  }
+
+  // connections [bounds[t], bounds[t + 1]) served by client and server threads 't'
+  std::vector<size_t> bounds;
+  for (size_t t = 0; t <= opts.threads; ++t)
+    bounds.push_back(t * conns.size() / opts.threads);
+  std::vector<thread_stats> client_stats(opts.threads);
+  std::vector<thread_stats> server_stats(opts.threads);
+
+  const double cpu_before = cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::vector<std::jthread> threads;
+    for (size_t t = 0; t < opts.threads; ++t) {
+      std::span<connection> part(conns.data() + bounds[t], bounds[t + 1] - bounds[t]);
+      threads.emplace_back([&, part, t] { server_thread(opts, part, server_stats[t]); });
+      threads.emplace_back([&, part, t] { client_thread(opts, part, client_stats[t]); });
+    }
+  }
+  const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const double cpu = cpu_seconds() - cpu_before;
+  const size_t rss_after = rss_bytes();
+
+  std::vector<uint32_t> latencies;
+  size_t headers = 0;
+  size_t bytes = 0;
+  size_t table_bytes = 0;
+  for (size_t t = 0; t < opts.threads; ++t) {
+    latencies.insert(latencies.end(), client_stats[t].latencies_ns.begin(), client_stats[t].latencies_ns.end());
+    headers += client_stats[t].headers;
+    bytes += client_stats[t].bytes;
+    table_bytes += client_stats[t].table_bytes_peak + server_stats[t].table_bytes_peak;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+  };
+  const double requests = double(latencies.size());
+
+  for (connection& c : conns) {
+    close(c.client_fd);
+    close(c.server_fd);
+  }
+
+  std::printf("connections %zu, threads %zu (x2), blocks per connection %zu, table size %zu, %s%s\n",
+              opts.connections, opts.threads, opts.blocks, opts.table_size, opts.cache ? "cache" : "no cache",
+              opts.huffman ? ", huffman" : "");
+  std::printf("requests            %12.0f (%.0f req/s)\n", requests, requests / wall);
+  std::printf("headers             %12zu (%.1f MB of blocks)\n", headers, bytes / 1e6);
+  std::printf("round latency p50   %12.1f us\n", percentile(0.50) / 1e3);
+  std::printf("round latency p99   %12.1f us\n", percentile(0.99) / 1e3);
+  std::printf("round latency max   %12.1f us\n", latencies.back() / 1e3);
+  std::printf("cpu per request     %12.2f us (both sides, incl. syscalls)\n", cpu / requests * 1e6);
+  std::printf("tables per conn     %12.0f bytes (peak, 4 tables)\n", double(table_bytes) / opts.connections);
+  std::printf("rss per conn        %12.0f bytes (incl. corpus and socket buffers)\n",
+              rss_after > rss_before ? double(rss_after - rss_before) / opts.connections : 0.0);
+}
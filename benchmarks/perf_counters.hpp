@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hpack_bench {
+
+// hardware counters collected around one benchmark, < 0 if counter unavailable
+struct perf_values {
+  double cycles = -1;
+  double instructions = -1;
+  double branch_misses = -1;
+  double cache_misses = -1;
+  double l1d_misses = -1;
+};
+
+// Linux perf_event_open counters of current thread (user space only),
+// each counter opened separately, so unsupported ones (e.g. in VM) do not disable others.
+// Values scaled if kernel multiplexes counters
+struct perf_counters {
+  enum counter_e { cycles, instructions, branch_misses, cache_misses, l1d_misses, counters_count };
+
+ private:
+  int fds[counters_count] = {-1, -1, -1, -1, -1};
+  std::string error;
+
+#ifdef __linux__
+  static int open_counter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+#endif
+
+ public:
+  perf_counters() {
+#ifdef __linux__
+    fds[cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    if (fds[cycles] < 0)
+      error = std::strerror(errno);
+    fds[instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[branch_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[cache_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[l1d_misses] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#else
+    error = "perf_event_open is linux only";
+#endif
+  }
+  perf_counters(perf_counters&&) = delete;
+  void operator=(perf_counters&&) = delete;
+
+  ~perf_counters() {
+#ifdef __linux__
+    for (int fd : fds)
+      if (fd >= 0)
+        close(fd);
+#endif
+  }
+
+  // true if at least one counter opened
+  [[nodiscard]] bool available() const noexcept {
+    for (int fd : fds)
+      if (fd >= 0)
+        return true;
+    return false;
+  }
+  // reason why cycles counter is not available
+  [[nodiscard]] const std::string& open_error() const noexcept {
+    return error;
+  }
+
+  void start() noexcept {
+#ifdef __linux__
+    for (int fd : fds) {
+      if (fd < 0)
+        continue;
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  perf_values stop() noexcept {
+    double v[counters_count] = {-1, -1, -1, -1, -1};
+#ifdef __linux__
+    for (int i = 0; i < counters_count; ++i) {
+      if (fds[i] < 0)
+        continue;
+      ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      // value, time enabled, time running
+      uint64_t data[3] = {};
+      if (read(fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        continue;
+      v[i] = double(data[0]) * (double(data[1]) / double(data[2]));
+    }
+#endif
+    return perf_values{
+        .cycles = v[cycles],
+        .instructions = v[instructions],
+        .branch_misses = v[branch_misses],
+        .cache_misses = v[cache_misses],
+        .l1d_misses = v[l1d_misses],
+    };
+  }
+};
+
+namespace noexport {
+
+inline std::string read_first_line(const char* path) {
+  std::ifstream f(path);
+  std::string line;
+  std::getline(f, line);
+  return line;
+}
+
+}  // namespace noexport
+
+// e.g. "Intel(R) Xeon(R) CPU @ 2.20GHz", empty if unknown
+inline std::string cpu_model() {
+  std::ifstream f("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(f, line)) {
+    if (line.starts_with("model name")) {
+      auto begin = line.find_first_not_of(" \t", line.find(':') + 1);
+      return begin == line.npos ? std::string() : line.substr(begin);
+    }
+  }
+  return {};
+}
+
+// e.g. "performance" or "powersave", empty if unknown (no cpufreq, e.g. in VM)
+inline std::string cpu_governor() {
+  return noexport::read_first_line("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor");
+}
+
+}  // namespace hpack_bench
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+/*
+  Compact storage format for logs of header lists (e.g. audit of requests / responses).
+  Header lists are encoded by one encoder in sequence, so repeated headers cost 1-2 bytes.
+  File is split into segments, each segment starts with fresh dynamic table filled
+  with seed dictionary (sync point), so any segment may be decoded independently.
+  All fields are little endian:
+
+  file:    "HPKA" version(u8) reserved(3 bytes) table_size(u32) seed_size(u32) seed
+           segment...
+           index
+  seed:    HPACK block of 'literal with incremental indexing' headers, order of insertion
+  segment: records_count(u32) payload_size(u32) payload
+  payload: for each record: size(HPACK integer, 8 bit prefix) HPACK block
+  index:   for each segment: offset(u64) first_record(u64) records_count(u32)
+           segments_count(u32) index_offset(u64) "HPKI"
+
+  Reader works over span of bytes, so whole file may be mmaped
+*/
+
+struct archive_writer_options {
+  // dynamic table size for all segments, bigger table - better compression for long segments
+  size_type table_size = 64 * 1024;
+  // sync point after this count of records, smaller segments - cheaper seek
+  size_t records_per_segment = 4096;
+  // headers inserted into dynamic table at each sync point (e.g. most frequent headers of logs)
+  std::vector<std::pair<std::string, std::string>> seed;
+  // huffman makes file smaller, but decoding slower
+  bool huffman = false;
+};
+
+struct archive_writer {
+  // receives bytes of file in order
+  using sink_t = std::function<void(std::span<const byte_t>)>;
+
+ private:
+  sink_t sink;
+  archive_writer_options opts;
+  encoder enc;
+  // current segment
+  std::vector<byte_t> payload;
+  size_t segment_records = 0;
+  // encoded record
+  std::vector<byte_t> record;
+  struct segment_info {
+    uint64_t offset;
+    uint64_t first_record;
+    uint32_t records_count;
+  };
+  std::vector<segment_info> segments;
+  uint64_t offset = 0;
+  uint64_t records = 0;
+  bool finished = false;
+
+  void write(std::span<const byte_t> bytes);
+  void start_segment();
+  void flush_segment();
+  // appends 'record' to current segment
+  void commit_record();
+
+ public:
+  // writes file header
+  explicit archive_writer(sink_t sink, archive_writer_options opts = {});
+
+  archive_writer(archive_writer&&) = delete;
+  void operator=(archive_writer&&) = delete;
+
+  // appends one header list, 'range_of_headers' as for encode_headers_block
+  void add(auto&& range_of_headers) {
+    assert(!finished);
+    record.clear();
+    if (opts.huffman)
+      encode_headers_block<true, true>(enc, range_of_headers, std::back_inserter(record));
+    else
+      encode_headers_block<true, false>(enc, range_of_headers, std::back_inserter(record));
+    commit_record();
+  }
+
+  // writes last segment and index, no records may be added after
+  void finish();
+
+  [[nodiscard]] uint64_t records_count() const noexcept {
+    return records;
+  }
+};
+
+// protocol error if file is malformed
+struct archive_reader {
+ private:
+  std::span<const byte_t> file;
+  size_type table_size = 0;
+  std::vector<std::pair<std::string, std::string>> seed;
+  struct segment_info {
+    uint64_t offset;
+    uint64_t first_record;
+    uint32_t records_count;
+  };
+  std::vector<segment_info> segments;
+  // begin of index
+  size_t data_end = 0;
+
+  // fresh decoder with seed in table
+  void sync(decoder& dec) const;
+  // payload of segment
+  std::span<const byte_t> segment_payload(size_t i) const;
+
+ public:
+  // 'file' must outlive reader
+  explicit archive_reader(std::span<const byte_t> file);
+
+  [[nodiscard]] size_t segments_count() const noexcept {
+    return segments.size();
+  }
+  [[nodiscard]] uint64_t records_count() const noexcept {
+    return segments.empty() ? 0 : segments.back().first_record + segments.back().records_count;
+  }
+
+  // visitor should accept (uint64_t record_number, std::string_view name, std::string_view value)
+  // 'dec' is reused between segments and reads: its table is reset and filled with seed,
+  // so only seed entries are allocated again
+  template <typename V>
+  V read_segment(size_t segment, decoder& dec, V visitor) const {
+    assert(segment < segments.size());
+    sync(dec);
+    std::span<const byte_t> bytes = segment_payload(segment);
+    In in = bytes.data();
+    In e = in + bytes.size();
+    uint64_t record_number = segments[segment].first_record;
+    for (uint32_t i = 0; i < segments[segment].records_count; ++i, ++record_number) {
+      if (in == e)
+        handle_protocol_error();
+      size_type len = decode_integer(in, e, 8);
+      if (len > e - in)
+        handle_protocol_error();
+      decode_headers_block(dec, std::span(in, len), [&](std::string_view name, std::string_view value) {
+        visitor(record_number, name, value);
+      });
+      in += len;
+    }
+    return visitor;
+  }
+
+  // decodes all records in order
+  template <typename V>
+  V read_all(decoder& dec, V visitor) const {
+    for (size_t i = 0; i < segments.size(); ++i)
+      read_segment(i, dec, std::ref(visitor));
+    return visitor;
+  }
+
+  // decodes one record (seek to its sync point, then decodes segment until record)
+  // visitor should accept (std::string_view name, std::string_view value)
+  // precondition: record < records_count()
+  template <typename V>
+  V read_record(uint64_t record, decoder& dec, V visitor) const {
+    assert(record < records_count());
+    auto it = std::upper_bound(segments.begin(), segments.end(), record,
+                               [](uint64_t r, const segment_info& s) { return r < s.first_record; });
+    size_t segment = std::distance(segments.begin(), it) - 1;
+    sync(dec);
+    std::span<const byte_t> bytes = segment_payload(segment);
+    In in = bytes.data();
+    In e = in + bytes.size();
+    header_view header;
+    for (uint64_t r = segments[segment].first_record; r <= record; ++r) {
+      if (in == e)
+        handle_protocol_error();
+      size_type len = decode_integer(in, e, 8);
+      if (len > e - in)
+        handle_protocol_error();
+      // previous records only update table
+      In block_end = in + len;
+      while (in != block_end) {
+        dec.decode_header(in, block_end, header);
+        if (r == record && header)
+          visitor(header.name.str(), header.value.str());
+      }
+    }
+    return visitor;
+  }
+};
+
+}  // namespace hpack
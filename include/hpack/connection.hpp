@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <memory_resource>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+struct connection_context_options {
+  // SETTINGS_HEADER_TABLE_SIZE of peer (encoder) and ours (decoder)
+  size_type encoder_table_size = 4096;
+  size_type decoder_table_size = 4096;
+  // expected max size of one headers block (SETTINGS_MAX_HEADER_LIST_SIZE), for decoding scratch
+  size_t max_block_size = 16 * 1024;
+  // representations in one block, for decoding scratch
+  size_t max_block_headers = 512;
+  // slab is allocated from it, and memory after slab exhausted
+  std::pmr::memory_resource* upstream = std::pmr::get_default_resource();
+  // everything preallocated at construction, no allocations after it:
+  // blocks bigger than 'max_block_size' or with more than 'max_block_headers' representations
+  // are protocol errors (size error), slab is never exhausted,
+  // hibernation of 'enc' / 'dec' tables is size error
+  bool no_heap = false;
+};
+
+namespace noexport {
+
+// bump allocation from slab, freed blocks are reused by power of 2 size classes,
+// 'upstream' if slab is exhausted or alignment is bigger than of max_align_t
+struct slab_resource : std::pmr::memory_resource {
+ private:
+  static constexpr size_t min_block_log2 = 4;
+  static constexpr size_t classes_count = 48;
+  struct free_block {
+    free_block* next;
+  };
+  std::pmr::memory_resource* upstream;
+  byte_t* begin;
+  byte_t* cur;
+  byte_t* end;
+  free_block* free_lists[classes_count] = {};
+
+ public:
+  slab_resource(void* slab, size_t size, std::pmr::memory_resource* upstream) noexcept
+      : upstream(upstream), begin((byte_t*)slab), cur(begin), end(begin + size) {
+  }
+
+  // size of block used for 'bytes'
+  [[nodiscard]] static constexpr size_t block_size(size_t bytes) noexcept {
+    return std::bit_ceil(std::max(bytes, size_t(1) << min_block_log2));
+  }
+
+  // bytes never allocated from slab
+  [[nodiscard]] size_t slab_bytes_left() const noexcept {
+    return end - cur;
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t align) override;
+  void do_deallocate(void* p, size_t bytes, size_t align) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+// entries of one dynamic table are allocated and freed in FIFO order (insertion / eviction),
+// so they are placed into ring buffer without fragmentation.
+// Blocks freed out of order (packed content of hibernated table) are reclaimed when oldest blocks
+// before them are freed.
+// Allocations before 'seal' are permanent (preallocated vector of entries, kept on hibernation)
+struct ring_resource : std::pmr::memory_resource {
+ private:
+  // before each block in ring
+  struct alignas(std::max_align_t) block_header {
+    size_t size;  // with header
+    bool freed;
+  };
+  std::pmr::memory_resource* upstream;
+  // [begin, ring_begin) - permanent allocations
+  byte_t* begin;
+  byte_t* ring_begin;
+  byte_t* end;
+  // used blocks are [tail, head) or [tail, wrap) + [ring_begin, head) if 'wrap' != nullptr
+  byte_t* head;
+  byte_t* tail;
+  byte_t* wrap = nullptr;
+  bool sealed = false;
+
+  void reclaim() noexcept;
+
+ public:
+  // precondition: 'buf' aligned as max_align_t
+  ring_resource(void* buf, size_t size, std::pmr::memory_resource* upstream) noexcept
+      : upstream(upstream),
+        begin((byte_t*)buf),
+        ring_begin(begin),
+        end(begin + size),
+        head(ring_begin),
+        tail(ring_begin) {
+  }
+
+  // starts ring after permanent allocations
+  void seal() noexcept {
+    sealed = true;
+    head = tail = ring_begin;
+  }
+
+  [[nodiscard]] static constexpr size_t round_up(size_t bytes) noexcept {
+    return (bytes + sizeof(block_header) - 1) / sizeof(block_header) * sizeof(block_header);
+  }
+
+  // max count of entries in table with 'max_size', each entry is at least 32 bytes
+  [[nodiscard]] static constexpr size_t max_entries(size_type max_size) noexcept {
+    return max_size / 32 + 1;
+  }
+
+  // size of ring (+ permanent vector of entries), which fits entries of table with 'max_size'
+  // for any sequence of operations without hibernation.
+  // Before eviction table holds old entries and new one (so 2 * max_size), each entry wastes
+  // header, alignment and entry_t fields over 32 bytes of RFC. Free space of ring may be split
+  // into two parts (before tail and after head), so ring is bigger by 2 max entries
+  [[nodiscard]] static constexpr size_t size_for_table(size_type max_size) noexcept {
+    constexpr size_t max_entry_waste = 2 * sizeof(block_header) + 64;
+    const size_t max_entry = max_size + max_entry_waste;
+    const size_t entries_vector = round_up(max_entries(max_size) * sizeof(void*));
+    return entries_vector + round_up(2 * (size_t(max_size) + max_entries(max_size) * max_entry_waste) +
+                                     2 * max_entry);
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t align) override;
+  void do_deallocate(void* p, size_t bytes, size_t align) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace noexport
+
+// encoder and decoder of one connection with all their memory carved from one slab:
+// entries of both dynamic tables (with search index nodes), vectors of entries
+// and scratch of block decoding (huffman strings are decoded into it, not malloced).
+// Slab is allocated once at construction and sized from table sizes, so memory of connection
+// is one allocation with good locality and teardown is one free.
+// Entries of each table are in ring buffer (table is FIFO), its size is enough for any sequence
+// of entries. Scratch grows if blocks are bigger than expected, then (or for hibernation)
+// memory may be taken from 'upstream'. With 'no_heap' nothing is allocated after construction
+struct connection_context {
+ private:
+  // declared first, so freed after all users of slab
+  struct slab_t {
+    std::pmr::memory_resource* upstream;
+    size_t size;
+    void* data;
+
+    slab_t(std::pmr::memory_resource* upstream, size_t size);
+    slab_t(slab_t&&) = delete;
+    void operator=(slab_t&&) = delete;
+    ~slab_t();
+  };
+  slab_t slab;
+  // entries of tables in own rings, decoding scratch in 'pool'
+  noexport::ring_resource encoder_entries;
+  noexport::ring_resource decoder_entries;
+  noexport::slab_resource pool;
+  // 0 if blocks are not limited
+  size_t max_block_size;
+
+ public:
+  encoder enc;
+  decoder dec;
+  block_decode_buffers buffers;
+
+  explicit connection_context(const connection_context_options& opts = {});
+
+  connection_context(connection_context&&) = delete;
+  void operator=(connection_context&&) = delete;
+
+  // slab size for 'opts': rings of tables (see ring_resource::size_for_table) + decoding scratch
+  [[nodiscard]] static size_t slab_size_for(const connection_context_options& opts) noexcept;
+
+  [[nodiscard]] size_t slab_size() const noexcept {
+    return slab.size;
+  }
+  // bytes of slab never allocated yet, 0 if memory may be taken from upstream
+  [[nodiscard]] size_t slab_bytes_left() const noexcept {
+    return pool.slab_bytes_left();
+  }
+
+  // same as decode_headers_block_interleaved with 'buffers', without mallocs for huffman strings
+  template <typename V>
+  V decode_block(std::span<const byte_t> bytes, V visitor) {
+    if (max_block_size && bytes.size() > max_block_size) [[unlikely]]
+      handle_size_error();
+    return decode_headers_block_interleaved(dec, bytes, buffers, std::move(visitor));
+  }
+};
+
+}  // namespace hpack
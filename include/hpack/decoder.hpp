@@ -2,8 +2,12 @@
 
 #include "hpack/basic_types.hpp"
 #include "hpack/dynamic_table.hpp"
+#include "hpack/huffman.hpp"
 
+#include <memory_resource>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace hpack {
 
@@ -124,8 +128,68 @@ struct header_view {
 // precondition: in != e
 void decode_string(In& in, In e, decoded_string& out);
 
+// header representation parsed from header block without touching dynamic table
+// and without decoding huffman strings
+struct header_representation {
+  enum kind_e : uint8_t {
+    fully_indexed,
+    with_indexing,
+    without_indexing,
+    never_indexed,
+    size_update,
+  };
+  kind_e kind = fully_indexed;
+  bool name_huffman = false;
+  bool value_huffman = false;
+  // header index for fully indexed, new size for size update, name index (0 if new name) for literals
+  index_type index = 0;
+  // literal strings as they are in block (possibly huffman encoded)
+  std::string_view name;
+  std::string_view value;
+};
+
+// parses one representation, strings point into block
+// precondition: in != e
+void scan_header(In& in, In e, header_representation& out);
+
+// reusable memory for block-level decoding, may be shared between decoders of one thread
+struct block_decode_buffers {
+  std::pmr::vector<header_representation> headers;
+  std::pmr::vector<huffman_decode_job> jobs;
+  // storage for decoded huffman strings
+  std::pmr::vector<char> decoded;
+  // name of too big entry, which was in dynamic table before it emptied
+  std::pmr::string evicted_name;
+  // for parallel decoding, task i decodes jobs [task_bounds[i], task_bounds[i + 1])
+  std::pmr::vector<size_t> task_bounds;
+  // blocks with more representations are size errors (for preallocated 'headers' and 'jobs')
+  size_t max_headers = size_t(-1);
+
+  block_decode_buffers() = default;
+  explicit block_decode_buffers(std::pmr::memory_resource* m)
+      : headers(m), jobs(m), decoded(m), evicted_name(m), task_bounds(m) {
+  }
+};
+
+// parses whole block into 'buf.headers' and decodes all huffman literals,
+// several of them in one loop (see huffman_decode_interleaved)
+// postcondition: 'buf.headers' do not contain huffman encoded strings
+// Note: dynamic table not touched, decoder::apply must be called for each header in order
+void scan_and_decode_block(std::span<const byte_t> bytes, block_decode_buffers& buf);
+
+// same as scan_and_decode_block in separate phases:
+//   scan_block - parses block into 'buf.headers' and fills 'buf.jobs', but not decodes them
+//   (caller decodes jobs, possibly in parallel)
+//   finish_block_decode - replaces huffman strings in 'buf.headers' by decoded ones
+void scan_block(std::span<const byte_t> bytes, block_decode_buffers& buf);
+void finish_block_decode(block_decode_buffers& buf) noexcept;
+
+// splits 'buf.jobs' into tasks with approximately equal count of bytes, fills 'buf.task_bounds'
+// returns count of tasks (>= 1, <= max_tasks)
+size_t split_huffman_jobs(block_decode_buffers& buf, size_t min_bytes_per_task, size_t max_tasks);
+
 struct decoder {
-  dynamic_table_t dyntab;
+  decoder_dynamic_table_t dyntab;
 
   // 4096 - default size in HTTP/2
   explicit decoder(size_type max_dyntab_size = 4096,
@@ -135,6 +199,15 @@ struct decoder {
 
   decoder(decoder&&) = default;
   decoder& operator=(decoder&&) noexcept = default;
+
+  // for idle connections, see dynamic_table_t::hibernate
+  // next use of decoder wakes it up transparently
+  void hibernate(bool compress = false) {
+    dyntab.hibernate(compress);
+  }
+  void wake() {
+    dyntab.wake();
+  }
   /*
    Note: this function ignores special 'cookie' header case
    https://www.rfc-editor.org/rfc/rfc7540#section-8.1.2.5
@@ -143,6 +216,27 @@ struct decoder {
   // precondition: in != e
   void decode_header(In& in, In e, header_view& out);
 
+  // fast path for runs of fully indexed headers with one byte index (< 127),
+  // frequent on warm connections. Decodes at most out.size() headers,
+  // returns count of decoded (0 if 'in' does not point to such representation)
+  // Note: returned values may be invalidated on next .decode_header() / .apply()
+  size_t decode_indexed_run(In& in, In e, std::span<table_entry> out);
+
+  // applies scanned header to dynamic table (insertion, size update) and resolves indexes
+  // returns empty entry for dynamic table size update
+  // precondition: strings of 'h' are not huffman encoded (decoded by scan_and_decode_block)
+  // Note: returned value may be invalidated on next .apply() / .decode_header()
+  table_entry apply(const header_representation& h, block_decode_buffers& buf);
+
+  // decodes header with decimal number value (content-length, :status, grpc-status),
+  // literal value (raw or huffman) accumulated directly into number, without decoding into string.
+  // Dynamic table size updates before header are applied.
+  // 'out.name' is set to header name, 'out.value' is unspecified,
+  // 'digits_count' (if not nullptr) receives count of digits of value, leading zeros included
+  // protocol error if value is not a decimal number or overflows uint64_t
+  // precondition: in != e
+  uint64_t decode_header_number(In& in, In e, header_view& out, size_type* digits_count = nullptr);
+
   // returns status code
   // its always first header of response, so 'in' must point to first byte of headers block
   // precondition: in != e
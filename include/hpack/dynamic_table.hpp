@@ -1,6 +1,10 @@
 #pragma once
 
 #include <memory_resource>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include <boost/intrusive/set.hpp>
 
@@ -11,7 +15,53 @@ namespace hpack {
 
 namespace bi = boost::intrusive;
 
-struct dynamic_table_t {
+// introspection of one dynamic table entry
+struct dyntab_entry_stats {
+  index_type index = 0;
+  // as defined in RFC, name + value + 32
+  size_type size = 0;
+  // 1 for first entry inserted into table, 2 for second etc
+  size_t insert_number = 0;
+  // found by encoder / referenced by index in decoder
+  uint32_t hits = 0;
+  std::string_view name;
+  std::string_view value;
+};
+
+// copy of dynamic table state, may be stored and dumped for analysis
+// (e.g. which headers churn the table, which table size is enough)
+struct dyntab_snapshot {
+  // same as dyntab_entry_stats, but owns strings
+  struct entry {
+    index_type index = 0;
+    size_type size = 0;
+    size_t insert_number = 0;
+    uint32_t hits = 0;
+    std::string name;
+    std::string value;
+  };
+  size_type current_size = 0;
+  size_type max_size = 0;
+  size_t insert_count = 0;
+  // ordered by index, newest first
+  std::vector<entry> entries;
+
+  // human readable, one entry per line
+  [[nodiscard]] std::string dump() const;
+};
+
+namespace noexport {
+
+// used instead of search index in tables which are accessed only by index
+struct no_search_index {};
+
+}  // namespace noexport
+
+// Searchable - entries are also indexed by (name, value) for 'find' (encoder).
+// Decoder accesses table only by index, so its table has no search index
+// and insertion is just append + size update, see decoder_dynamic_table_t
+template <bool Searchable>
+struct basic_dynamic_table_t {
   struct entry_t;
 
  private:
@@ -21,10 +71,15 @@ struct dynamic_table_t {
   };
   // for forward declaring entry_t
   using hook_type_option = bi::base_hook<bi::set_base_hook<bi::link_mode<bi::normal_link>>>;
+  using search_index_t = std::conditional_t<
+      Searchable,
+      bi::multiset<entry_t, bi::constant_time_size<false>, hook_type_option, bi::key_of_value<key_of_entry>>,
+      noexport::no_search_index>;
 
   // invariant: do not contain nullptrs
-  std::vector<entry_t*> entries;
-  bi::multiset<entry_t, bi::constant_time_size<false>, hook_type_option, bi::key_of_value<key_of_entry>> set;
+  // allocated by '_resource' (by default resource if default constructed)
+  std::pmr::vector<entry_t*> entries;
+  [[no_unique_address]] search_index_t set;
   // in bytes
   // invariant: <= _max_size
   size_type _current_size = 0;
@@ -32,6 +87,17 @@ struct dynamic_table_t {
   size_t _insert_count = 0;
   // invariant: != nullptr
   std::pmr::memory_resource* _resource = std::pmr::get_default_resource();
+  // packed content of table while hibernated, 'entries' and 'set' are empty then
+  struct hibernated_t {
+    size_t size;       // of 'data'
+    size_type count;   // of entries
+    byte_t data[];     // entries from oldest to newest: hits, name, value
+  };
+  hibernated_t* _hibernated = nullptr;
+  // vector of entries preallocated by reserve_entries, kept on hibernation
+  bool _entries_reserved = false;
+  // set by disable_hibernation
+  bool _hibernation_disabled = false;
   /*
          <----------  Index Address Space ---------->
          <-- Static  Table -->  <-- Dynamic Table -->
@@ -43,23 +109,33 @@ struct dynamic_table_t {
                          Insertion Point      Dropping Point
   */
  public:
-  dynamic_table_t() = default;
-  explicit dynamic_table_t(size_type max_size,
-                           std::pmr::memory_resource* m = std::pmr::get_default_resource()) noexcept;
+  basic_dynamic_table_t() = default;
+  explicit basic_dynamic_table_t(size_type max_size,
+                                 std::pmr::memory_resource* m = std::pmr::get_default_resource()) noexcept;
 
-  dynamic_table_t(const dynamic_table_t&) = delete;
+  basic_dynamic_table_t(const basic_dynamic_table_t&) = delete;
 
-  dynamic_table_t(dynamic_table_t&& other) noexcept;
+  basic_dynamic_table_t(basic_dynamic_table_t&& other) noexcept;
 
-  void operator=(const dynamic_table_t&) = delete;
+  void operator=(const basic_dynamic_table_t&) = delete;
 
-  dynamic_table_t& operator=(dynamic_table_t&& other) noexcept;
+  basic_dynamic_table_t& operator=(basic_dynamic_table_t&& other) noexcept;
 
-  ~dynamic_table_t();
+  ~basic_dynamic_table_t();
 
   // returns index of added pair, 0 if cannot add
   index_type add_entry(std::string_view name, std::string_view value);
 
+  // same, value is concatenation of 'value_chunks', copied into entry without temporary string
+  index_type add_entry(std::string_view name, std::span<const std::string_view> value_chunks);
+
+  // preallocates vector of entries, so adding up to 'count' entries does not allocate it,
+  // vector is not released on hibernation
+  void reserve_entries(size_type count) {
+    entries.reserve(count);
+    _entries_reserved = true;
+  }
+
   size_type current_size() const noexcept {
     return _current_size;
   }
@@ -69,33 +145,108 @@ struct dynamic_table_t {
 
   void update_size(size_type new_max_size);
 
-  // min value is static_table_t::first_unused_index
+  // max valid index of header in static + dynamic tables,
+  // min value is static_table_t::first_unused_index - 1 (empty dynamic table)
   index_type current_max_index() const noexcept {
-    return entries.size() + static_table_t::first_unused_index;
+    return entries_count() + static_table_t::first_unused_index - 1;
   }
 
-  find_result_t find(std::string_view name, std::string_view value) noexcept;
-  find_result_t find(index_type name, std::string_view value) noexcept;
+  // linear search if !Searchable (for tests and debugging only)
+  find_result_t find(std::string_view name, std::string_view value);
+  find_result_t find(index_type name, std::string_view value);
 
-  // precondition: first_unused_index <= index <= current_max_index()
+  // empty entry if index is not in dynamic table or table is hibernated
   // Note: returned value may be invalidated on next .add_entry()
   table_entry get_entry(index_type index) const noexcept;
 
+  // same as get_entry, but counts hit of entry (see entry_stats)
+  table_entry reference_entry(index_type index);
+
+  // hint, starts loading of entry into cache, does nothing for index out of dynamic table.
+  // Reads pointer to entry, so may stall on it if 'prefetch_slot' was not called some time before
+  void prefetch(index_type index) const noexcept;
+
+  // hint, first stage of 'prefetch': starts loading of pointer to entry, does not read it
+  void prefetch_slot(index_type index) const noexcept;
+
+  // empty stats (index 0) if index is not in dynamic table or table is hibernated
+  // Note: returned strings may be invalidated on next .add_entry()
+  [[nodiscard]] dyntab_entry_stats entry_stats(index_type index) const noexcept;
+
+  // does not wake hibernated table, reads its packed content
+  [[nodiscard]] dyntab_snapshot snapshot() const;
+
+  // for idle connections: packs content of table into one allocation
+  // (with huffman encoded strings if 'compress' and it is shorter),
+  // releases all entries and index structures.
+  // Table is woken up transparently by next add_entry / find / reference_entry / update_size
+  void hibernate(bool compress = false);
+
+  // for tables whose memory cannot hold packed content (no-heap connection_context):
+  // hibernate() is size error then, table is not changed
+  void disable_hibernation() noexcept {
+    _hibernation_disabled = true;
+  }
+
+  // rebuilds entries from packed content, does nothing if not hibernated
+  void wake();
+
+  bool hibernated() const noexcept {
+    return _hibernated != nullptr;
+  }
+
+  // memory used by table content and index structures
+  // (without allocator overhead and this object)
+  [[nodiscard]] size_t allocated_bytes() const noexcept;
+
+  // count of entries inserted since creation
+  size_t insert_count() const noexcept {
+    return _insert_count;
+  }
+
+  // also drops hibernated content
   void reset() noexcept;
   std::pmr::memory_resource* get_resource() const noexcept {
     return _resource;
   }
 
  private:
+  size_type entries_count() const noexcept {
+    return _hibernated ? _hibernated->count : entries.size();
+  }
+  void wake_if_hibernated() {
+    if (_hibernated) [[unlikely]]
+      wake();
+  }
+  void free_hibernated() noexcept;
+  // calls 'f(hits, name, value)' for each entry of packed content, from oldest to newest
+  template <typename F>
+  void unpack(const hibernated_t& h, F&& f) const;
   // precondition: bytes <= _max_size
   void evict_until_fits_into(size_type bytes) noexcept;
   // precondition: entry now in 'entries'
   index_type indexof(const entry_t& e) const noexcept;
+  // precondition: first_unused_index <= index <= current_max_index()
+  entry_t& entry_by_index(index_type index) const noexcept;
+  // search index maintenance, nothing for !Searchable
+  void index_insert(entry_t& e);
+  void index_erase(entry_t& e) noexcept;
+  void index_clear() noexcept;
 };
 
+// instantiated in dynamic_table.cpp
+extern template struct basic_dynamic_table_t<true>;
+extern template struct basic_dynamic_table_t<false>;
+
+// for encoder
+using dynamic_table_t = basic_dynamic_table_t<true>;
+// for decoder, index only
+using decoder_dynamic_table_t = basic_dynamic_table_t<false>;
+
 // searches in both static and dynamic tables
 // dyntab is used only if required (index >= 62)
-[[nodiscard]] inline table_entry get_by_index(index_type header_index, dynamic_table_t* dyntab) {
+template <bool Searchable>
+[[nodiscard]] table_entry get_by_index(index_type header_index, basic_dynamic_table_t<Searchable>* dyntab) {
   /*
      Indices strictly greater than the sum of the lengths of both tables
      MUST be treated as a decoding error.
@@ -106,7 +257,7 @@ struct dynamic_table_t {
     return static_table_t::get_entry(header_index);
   if (header_index > dyntab->current_max_index()) [[unlikely]]
     handle_protocol_error();
-  return dyntab->get_entry(header_index);
+  return dyntab->reference_entry(header_index);
 }
 
 }  // namespace hpack
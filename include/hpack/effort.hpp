@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+struct effort_controller_options {
+  // load (CPU utilization, queue depth as percent of capacity) above which effort is lowered by one level
+  unsigned high_load_percent = 85;
+  // load below which effort is raised by one level,
+  // gap between thresholds prevents switching level on each report
+  unsigned low_load_percent = 60;
+};
+
+// effort of encoding for all encoders which use it, switched at runtime without recreating encoders:
+// cheaper encoding when CPU bound, maximum compression when egress bandwidth bound.
+// Thread safe, level is read by encoders with relaxed load once per block
+struct effort_controller {
+ private:
+  std::atomic<encode_effort> level;
+  effort_controller_options opts;
+
+ public:
+  explicit effort_controller(encode_effort initial = encode_effort::max,
+                             effort_controller_options opts = {}) noexcept
+      : level(initial), opts(opts) {
+  }
+
+  effort_controller(effort_controller&&) = delete;
+  void operator=(effort_controller&&) = delete;
+
+  [[nodiscard]] encode_effort get() const noexcept {
+    return level.load(std::memory_order_relaxed);
+  }
+
+  void set(encode_effort e) noexcept {
+    level.store(e, std::memory_order_relaxed);
+  }
+
+  // feeds current load, changes level by at most one step, returns new level
+  encode_effort report_load(unsigned load_percent) noexcept;
+};
+
+// process-wide controller, default for encode_headers_block_adaptive
+[[nodiscard]] effort_controller& global_effort_controller() noexcept;
+
+// same as encode_headers_block, but effort of whole block is current level of 'controller'
+template <Out O>
+O encode_headers_block_adaptive(encoder& enc, auto&& range_of_headers, O out,
+                                const effort_controller& controller = global_effort_controller()) {
+  const encode_effort effort = controller.get();
+  for (auto&& [name, value] : range_of_headers)
+    out = enc.encode(name, value, effort, out);
+  return out;
+}
+
+}  // namespace hpack
@@ -1,11 +1,28 @@
 #pragma once
 
+#include <charconv>
+#include <concepts>
+#include <limits>
+#include <span>
+
 #include "hpack/dynamic_table.hpp"
 #include "hpack/strings.hpp"
 #include "hpack/integers.hpp"
 
 namespace hpack {
 
+// cost of encoding against size of encoded, chosen at runtime (see effort_controller)
+enum struct encode_effort : uint8_t {
+  // static table only: no dynamic table probes and insertions, raw strings
+  static_only,
+  // static and dynamic tables, indexing, raw strings
+  no_huffman,
+  // huffman, indexes only values small relative to dynamic table (big ones evict many entries)
+  balanced,
+  // same as encode<true, true>
+  max,
+};
+
 struct encoder {
   dynamic_table_t dyntab;
 
@@ -18,6 +35,15 @@ struct encoder {
   encoder(encoder&&) = default;
   encoder& operator=(encoder&&) noexcept = default;
 
+  // for idle connections, see dynamic_table_t::hibernate
+  // next use of encoder wakes it up transparently
+  void hibernate(bool compress = false) {
+    dyntab.hibernate(compress);
+  }
+  void wake() {
+    dyntab.wake();
+  }
+
   // indexed name and value, for example ":path" "/index.html" from static table
   // or some index from dynamic table
   template <Out O>
@@ -226,6 +252,75 @@ struct encoder {
       return encode_header_without_indexing<Huffman>(name, value, out);
   }
 
+  // same as encode<Cache, Huffman>, but parameters are chosen by 'effort' at runtime
+  template <Out O>
+  O encode(std::string_view name, std::string_view value, encode_effort effort, O out) {
+    switch (effort) {
+      case encode_effort::static_only: {
+        find_result_t r = static_table_t::find(name, value);
+        if (r.value_indexed)
+          return encode_header_fully_indexed(r.header_name_index, out);
+        if (r)
+          return encode_header_without_indexing<false>(r.header_name_index, value, out);
+        return encode_header_without_indexing<false>(name, value, out);
+      }
+      case encode_effort::no_huffman:
+        return encode<true, false>(name, value, out);
+      case encode_effort::balanced:
+        if (value.size() > dyntab.max_size() / 8)
+          return encode<false, true>(name, value, out);
+        return encode<true, true>(name, value, out);
+      case encode_effort::max:
+        break;
+    }
+    return encode<true, true>(name, value, out);
+  }
+
+  // numeric value (content-length, :status, grpc-status), digits are written
+  // directly from stack buffer (raw or huffman), without intermediate string
+  // (bool is not a number here)
+  template <bool Cache = false, bool Huffman = false, std::unsigned_integral T, Out O>
+    requires(!std::same_as<T, bool>)
+  O encode(std::string_view name, T value, O out) {
+    char buf[std::numeric_limits<T>::digits10 + 1];
+    char* e = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+    return encode<Cache, Huffman>(name, std::string_view(buf, e), out);
+  }
+
+  template <bool Cache = false, bool Huffman = false, std::unsigned_integral T, Out O>
+    requires(!std::same_as<T, bool>)
+  O encode(index_type name, T value, O out) {
+    char buf[std::numeric_limits<T>::digits10 + 1];
+    char* e = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+    return encode<Cache, Huffman>(name, std::string_view(buf, e), out);
+  }
+
+  // value is concatenation of 'value_chunks' (big set-cookie lists, tracing baggage assembled by parts),
+  // chunks are written directly into 'out' (and into dynamic table entry), never concatenated.
+  // Such values are big and rarely repeat, so only name is searched (in static table).
+  // With 'Cache' header is inserted into dynamic table only if it fits,
+  // too big entry would just evict whole table
+  template <bool Cache = false, bool Huffman = false, Out O>
+  O encode_chunked(std::string_view name, std::span<const std::string_view> value_chunks, O _out) {
+    size_t value_len = 0;
+    for (std::string_view chunk : value_chunks)
+      value_len += chunk.size();
+    const index_type name_index = static_table_t::find(name);
+    const bool cache = Cache && name.size() + value_len + 32 <= dyntab.max_size();
+    auto out = noexport::adapt_output_iterator(_out);
+    // with incremental indexing 0b01... (6+), otherwise without indexing 0b0000... (4+)
+    *out = cache ? 0b0100'0000 : 0;
+    if (name_index) {
+      out = encode_integer(name_index, cache ? 6 : 4, out);
+    } else {
+      ++out;
+      out = encode_string<Huffman>(name, out);
+    }
+    if (cache)
+      dyntab.add_entry(name, value_chunks);
+    return noexport::unadapt<O>(encode_string_chunks<Huffman>(value_chunks, out));
+  }
+
   /*
   An encoder can choose to use less capacity than this maximum size
      (see Section 6.3), but the chosen size MUST stay lower than or equal
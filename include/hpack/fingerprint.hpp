@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hpack/basic_types.hpp"
+
+namespace hpack {
+
+// running state of one fingerprint, see header_fingerprint
+struct fingerprint_state {
+  uint64_t sum = 0;
+  uint32_t count = 0;
+};
+
+// fingerprint of selected headers of header list (e.g. key of edge cache over Vary headers,
+// key of request coalescing or rate limiting), computed while decoding,
+// see decode_headers_block_fingerprint.
+// Fingerprint is canonical: does not depend on order of headers and on not selected headers,
+// but depends on count of repeated headers.
+// Note: not cryptographic and not stable between versions / platforms, do not store it
+struct header_fingerprint {
+ private:
+  // lowercase, sorted and unique by constructor, binary searched by 'selects'
+  std::vector<std::string> names;
+  // bit (len % 64) set if some of 'names' has such length, fast rejection of other headers
+  uint64_t lengths_mask = 0;
+  bool all = true;
+  uint64_t seed = 0;
+
+ public:
+  // all headers of list
+  explicit header_fingerprint(uint64_t seed = 0) noexcept : seed(seed) {
+  }
+  // only headers with names from 'selected' (case insensitive)
+  explicit header_fingerprint(std::span<const std::string_view> selected, uint64_t seed = 0);
+  header_fingerprint(std::initializer_list<std::string_view> selected, uint64_t seed = 0)
+      : header_fingerprint(std::span(selected.begin(), selected.size()), seed) {
+  }
+
+  // 'name' expected lowercase, as in HTTP/2
+  [[nodiscard]] bool selects(std::string_view name) const noexcept {
+    if (all)
+      return true;
+    if (!(lengths_mask & (uint64_t(1) << (name.size() % 64))))
+      return false;
+    return std::binary_search(names.begin(), names.end(), name, std::less<>{});
+  }
+
+  // hash of one header, includes lengths, so ("ab", "c") and ("a", "bc") differ
+  [[nodiscard]] uint64_t hash(std::string_view name, std::string_view value) const noexcept;
+
+  void add(fingerprint_state& state, std::string_view name, std::string_view value) const noexcept {
+    if (!selects(name))
+      return;
+    state.sum += hash(name, value);
+    ++state.count;
+  }
+
+  [[nodiscard]] uint64_t finish(const fingerprint_state& state) const noexcept;
+
+  // fingerprint of already decoded list, same as computed while decoding
+  [[nodiscard]] uint64_t of(auto&& range_of_headers) const noexcept {
+    fingerprint_state state;
+    for (auto&& [name, value] : range_of_headers)
+      add(state, name, value);
+    return finish(state);
+  }
+};
+
+}  // namespace hpack
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <exception>
 #include <span>
+#include <thread>
+#include <vector>
 
 #include "hpack/encoder.hpp"
 #include "hpack/decoder.hpp"
+#include "hpack/fingerprint.hpp"
 
 namespace hpack {
 
@@ -27,7 +31,14 @@ V decode_headers_block(decoder& dec, std::span<const byte_t> bytes, V visitor) {
   const auto* in = bytes.data();
   const auto* e = in + bytes.size();
   header_view header;
+  table_entry run[16];
   while (in != e) {
+    // fully indexed headers do not change dynamic table, so all entries of run are valid
+    if (size_t n = dec.decode_indexed_run(in, e, run)) {
+      for (size_t i = 0; i < n; ++i)
+        visitor(run[i].name, run[i].value);
+      continue;
+    }
     dec.decode_header(in, e, header);
     if (header)  // dynamic size update decoded without error
       visitor(header.name.str(), header.value.str());
@@ -35,4 +46,175 @@ V decode_headers_block(decoder& dec, std::span<const byte_t> bytes, V visitor) {
   return visitor;
 }
 
+// same as decode_headers_block, but also computes fingerprint of headers selected by 'fp'
+// (see header_fingerprint), each header hashed right after decoding, while its strings are in cache.
+// Visitor is not copied, returns fingerprint
+template <typename V>
+uint64_t decode_headers_block_fingerprint(decoder& dec, std::span<const byte_t> bytes,
+                                          const header_fingerprint& fp, V&& visitor) {
+  fingerprint_state state;
+  decode_headers_block(dec, bytes, [&](std::string_view name, std::string_view value) {
+    fp.add(state, name, value);
+    visitor(name, value);
+  });
+  return fp.finish(state);
+}
+
+namespace noexport {
+
+template <typename V>
+V apply_block(decoder& dec, block_decode_buffers& buf, V visitor) {
+  for (const header_representation& h : buf.headers) {
+    table_entry entry = dec.apply(h, buf);
+    if (h.kind != header_representation::size_update)
+      visitor(entry.name, entry.value);
+  }
+  return visitor;
+}
+
+}  // namespace noexport
+
+// same as decode_headers_block, but firstly locates and decodes all huffman literals of block,
+// several strings in one loop, then applies headers to dynamic table in order.
+// Faster for blocks with many huffman strings
+// 'buf' may be reused between blocks (and decoders), its scratch grows to biggest block
+// and is not reallocated after
+template <typename V>
+V decode_headers_block_interleaved(decoder& dec, std::span<const byte_t> bytes, block_decode_buffers& buf,
+                                   V visitor) {
+  scan_and_decode_block(bytes, buf);
+  return noexport::apply_block(dec, buf, std::move(visitor));
+}
+
+// one connection of decode_headers_blocks_batch
+struct batch_decode_item {
+  decoder* dec = nullptr;
+  std::span<const byte_t> bytes;
+  // protocol error (or other exception) of this connection, other connections are decoded anyway
+  std::exception_ptr error = nullptr;
+};
+
+namespace noexport {
+
+// index which will be used by next representation, 0 if unknown (multibyte index, new name)
+inline index_type peek_index(In in, In e) noexcept {
+  if (in == e)
+    return 0;
+  byte_t b = *in;
+  if (b & 0b1000'0000)
+    return b == 0xFF ? 0 : b & 0b0111'1111;
+  if (b & 0b0100'0000)
+    return (b & 0b0011'1111) == 0b0011'1111 ? 0 : b & 0b0011'1111;
+  if (b & 0b0010'0000)
+    return 0;
+  return (b & 0b1111) == 0b1111 ? 0 : b & 0b1111;
+}
+
+}  // namespace noexport
+
+// decodes blocks of many connections (e.g. all ready connections of event loop),
+// one header of each connection in turn, prefetching dynamic table entry of next connection
+// (and pointer to it one connection earlier), so cache misses of one cold table are hidden
+// behind decoding of other connections.
+// visitor should accept (size_t item_index, std::string_view name, std::string_view value),
+// headers of one connection are visited in order
+// exceptions from decoders are stored into items[i].error, exceptions from visitor are propagated
+template <typename V>
+V decode_headers_blocks_batch(std::span<batch_decode_item> items, V visitor) {
+  // positions of not finished connections
+  struct cursor_t {
+    size_t item;
+    In in;
+    In e;
+  };
+  std::vector<cursor_t> cursors;
+  cursors.reserve(items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    items[i].error = nullptr;
+    if (!items[i].bytes.empty())
+      cursors.push_back({i, items[i].bytes.data(), items[i].bytes.data() + items[i].bytes.size()});
+  }
+  header_view header;
+  while (!cursors.empty()) {
+    size_t alive = 0;
+    const size_t n = cursors.size();
+    for (size_t i = 0; i < n; ++i) {
+      // pointer to entry for cursor after next, entry itself for next one
+      // (after wrap around these are first cursors alive in next round)
+      size_t j = i + 2;
+      while (j >= n)
+        j -= n;
+      const cursor_t& after_next = cursors[j];
+      items[after_next.item].dec->dyntab.prefetch_slot(noexport::peek_index(after_next.in, after_next.e));
+      const cursor_t& next = cursors[i + 1 == n ? 0 : i + 1];
+      items[next.item].dec->dyntab.prefetch(noexport::peek_index(next.in, next.e));
+      cursor_t c = cursors[i];
+      decoder& dec = *items[c.item].dec;
+      try {
+        dec.decode_header(c.in, c.e, header);
+      } catch (...) {
+        items[c.item].error = std::current_exception();
+        continue;
+      }
+      if (header)  // dynamic size update decoded without error
+        visitor(c.item, header.name.str(), header.value.str());
+      if (c.in != c.e)
+        cursors[alive++] = c;
+    }
+    cursors.resize(alive);
+  }
+  return visitor;
+}
+
+// simplest 'parallel_for' for decode_headers_block_parallel, thread per task.
+// Prefer thread pool of your application
+struct thread_parallel_for {
+  template <typename F>
+  void operator()(size_t n, F&& f) const {
+    std::vector<std::jthread> threads;
+    threads.reserve(n);
+    for (size_t i = 1; i < n; ++i)
+      threads.emplace_back([&f, i] { f(i); });
+    if (n)
+      f(0);
+  }
+};
+
+struct parallel_decode_options {
+  // blocks with less bytes of huffman strings are decoded in current thread
+  size_t min_bytes_per_task = 16 * 1024;
+  size_t max_tasks = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// two-phase decoding for huge blocks (e.g. hundreds of kilobytes of cookies and tracing baggage):
+//   sequential scan resolves representation boundaries without decoding huffman strings,
+//   then huffman strings decoded by several tasks, then headers applied to dynamic table in order.
+// 'parallel_for(n, f)' must call f(0) ... f(n - 1), possibly concurrently, and return when all done
+// Note: one huffman string is never splitted between tasks
+template <typename V, typename ParallelFor>
+V decode_headers_block_parallel(decoder& dec, std::span<const byte_t> bytes, block_decode_buffers& buf,
+                                ParallelFor&& parallel_for, V visitor, parallel_decode_options opts = {}) {
+  scan_block(bytes, buf);
+  size_t tasks = split_huffman_jobs(buf, opts.min_bytes_per_task, opts.max_tasks);
+  if (tasks == 1) {
+    huffman_decode_interleaved(buf.jobs);
+  } else {
+    // protocol errors may be thrown in other threads
+    std::vector<std::exception_ptr> errors(tasks);
+    parallel_for(tasks, [&](size_t i) {
+      try {
+        huffman_decode_interleaved(
+            std::span(buf.jobs).subspan(buf.task_bounds[i], buf.task_bounds[i + 1] - buf.task_bounds[i]));
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+    for (std::exception_ptr& e : errors)
+      if (e)
+        std::rethrow_exception(e);
+  }
+  finish_block_decode(buf);
+  return noexport::apply_block(dec, buf, std::move(visitor));
+}
+
 }  // namespace hpack
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <span>
+#include <string_view>
+
+#include "hpack/basic_types.hpp"
+
+namespace hpack {
+
+// incremental huffman encoding, bits not yet written as whole bytes
+struct huffman_encoder_state {
+  uint64_t bits = 0;
+  uint32_t count = 0;
+};
+
+// max count of bytes written by huffman_encode_chunk for 'str_len' chars
+[[nodiscard]] constexpr size_t max_huffman_chunk_size(size_t str_len) noexcept {
+  // max code len is 30 bits, + not written bits of state
+  return (str_len * 30 + 31) / 8 + 4;
+}
+
+// appends huffman codes of 'str' to 'state', writes complete bytes into 'out' (at most 31 bits
+// stay in state), returns end of written bytes
+// precondition: 'out' has at least max_huffman_chunk_size(str.size()) bytes
+byte_t* huffman_encode_chunk(std::string_view str, huffman_encoder_state& state, byte_t* out) noexcept;
+
+// writes rest bits of 'state' padded with ones (EOS prefix) to byte boundary
+// precondition: 'out' has at least 4 bytes
+byte_t* huffman_encode_finish(huffman_encoder_state& state, byte_t* out) noexcept;
+
+namespace noexport {
+
+// implementations of huffman_encode_chunk, it uses avx2 for long strings if CPU supports it
+enum struct huffman_encode_path { scalar, avx2 };
+
+[[nodiscard]] bool huffman_encode_path_supported(huffman_encode_path path) noexcept;
+
+// huffman_encode_chunk by 'path' for any string size (for tests and benchmarks)
+// precondition: huffman_encode_path_supported(path)
+byte_t* huffman_encode_chunk(std::string_view str, huffman_encoder_state& state, byte_t* out,
+                             huffman_encode_path path) noexcept;
+
+}  // namespace noexport
+
+// size of buffer required for decoding
+[[nodiscard]] constexpr size_t max_huffman_string_size_after_decode(size_type huffman_str_len) noexcept {
+  // minimal symbol in table is 5 bit len, so worst case is only 5 bit symbols
+  // + 1 byte, decoder may write (not emit) one byte after decoded string
+  return size_t(huffman_str_len) * 8 / 5 + 1;
+}
+
+// decodes huffman string 'in'..'in' + 'len' into 'out'
+// precondition: 'out' has at least max_huffman_string_size_after_decode(len) bytes
+// returns count of decoded chars
+// protocol error on incorrect padding or EOS in string
+size_type huffman_decode(In in, size_type len, char* out);
+
+// decodes huffman string of decimal digits directly into 'value', without decoding into chars
+// 'digits_count' (if not nullptr) receives count of digits, leading zeros included
+// returns false if string is empty, contains not a digit or number overflows uint64_t
+// protocol error on incorrect padding or EOS in string
+bool huffman_decode_number(In in, size_type len, uint64_t& value, size_type* digits_count = nullptr);
+
+/*
+  standalone huffman codec (RFC 7541 5.2, e.g. for QPACK or compression of logs),
+  without string length prefix, no allocations, same kernels as encoder / decoder
+*/
+
+// exact count of bytes of encoded 'str' (with padding)
+[[nodiscard]] size_t huffman_encoded_size(std::string_view str) noexcept;
+
+// same for concatenation of 'chunks', without concatenating them
+[[nodiscard]] size_t huffman_encoded_size(std::span<const std::string_view> chunks) noexcept;
+
+// exact count of chars after decoding
+// protocol error on incorrect padding or EOS in string
+[[nodiscard]] size_t huffman_decoded_size(std::span<const byte_t> huffman_str);
+
+// encodes 'str' into 'out', returns encoded bytes (prefix of 'out')
+// precondition: out.size() >= huffman_encoded_size(str)
+std::span<byte_t> huffman_encode(std::string_view str, std::span<byte_t> out) noexcept;
+
+// decodes 'huffman_str' into 'out', returns decoded chars (prefix of 'out')
+// faster if out.size() >= max_huffman_string_size_after_decode(huffman_str.size()),
+// but huffman_decoded_size(huffman_str) bytes are enough
+// protocol error on incorrect padding, EOS in string or if 'out' is too small
+std::span<char> huffman_decode(std::span<const byte_t> huffman_str, std::span<char> out);
+
+// one huffman literal of header block
+struct huffman_decode_job {
+  In in = nullptr;
+  size_type len = 0;
+  // must have at least max_huffman_string_size_after_decode(len) bytes
+  char* out = nullptr;
+  // filled after decoding
+  size_type decoded_len = 0;
+};
+
+// same as huffman_decode for each job, but decodes several strings in one loop
+// (each string is a serial dependency chain, independent strings fill CPU pipeline)
+void huffman_decode_interleaved(std::span<huffman_decode_job> jobs);
+
+}  // namespace hpack
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+// what encoder learned about one header name
+struct learned_name_stats {
+  // encoded headers with this name
+  uint32_t seen = 0;
+  // value was equal to one of recent values of same name, so indexing it pays off
+  uint32_t repeats = 0;
+  // values measured for huffman decision (see learned_policy_options::huffman_sample_period)
+  uint32_t huffman_samples = 0;
+  // sums of sizes of measured values, raw and huffman encoded
+  uint64_t raw_bytes = 0;
+  uint64_t huffman_bytes = 0;
+};
+
+struct learned_policy_options {
+  // names tracked, other names are encoded with default decisions
+  size_t max_names = 256;
+  // decisions are default until name is seen this count of times
+  uint32_t min_samples = 8;
+  // name is not indexed if less than this percent of its values repeat (request ids, timestamps)
+  uint32_t min_repeat_percent = 10;
+  // counters are halved when 'seen' reaches it, so stats follow changes of traffic
+  uint32_t decay_after = 4096;
+  // after 'min_samples' huffman size is measured only for each such value of name,
+  // other values are encoded by learned decision without pass over string
+  uint32_t huffman_sample_period = 16;
+  // huffman is used if it makes values of name at least this percent shorter,
+  // values which barely compress (hex ids, base64) are not worth CPU
+  uint32_t min_huffman_saving_percent = 5;
+  // default decisions
+  bool index = true;
+  bool huffman = true;
+};
+
+// how to encode one header
+struct header_decision {
+  bool index = true;
+  bool huffman = true;
+};
+
+// learned stats of all names, exported from connection and imported into next connection to same peer
+struct learned_policy_snapshot {
+  // most frequent names first
+  std::vector<std::pair<std::string, learned_name_stats>> names;
+};
+
+// per-name statistics learned by encoder: which headers are worth indexing
+// (values repeat), which are volatile and whether huffman makes values shorter.
+// One per encoder (connection), see encode_headers_block_learned
+struct learned_policy {
+ private:
+  struct name_state {
+    learned_name_stats stats;
+    // hashes of recent values
+    uint64_t recent[4] = {};
+    uint8_t next_recent = 0;
+  };
+  struct string_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view str) const noexcept {
+      return std::hash<std::string_view>{}(str);
+    }
+  };
+  std::unordered_map<std::string, name_state, string_hash, std::equal_to<>> names;
+  learned_policy_options opts;
+
+  [[nodiscard]] header_decision decide(const learned_name_stats& stats) const noexcept;
+
+ public:
+  explicit learned_policy(learned_policy_options opts = {}) : opts(opts) {
+  }
+
+  // updates stats of 'name' by 'value', returns how to encode it
+  header_decision observe(std::string_view name, std::string_view value);
+
+  // decision for 'name' by current stats, without updating them
+  [[nodiscard]] header_decision decision_for(std::string_view name) const noexcept;
+
+  // nullptr if 'name' is not tracked
+  [[nodiscard]] const learned_name_stats* stats_of(std::string_view name) const noexcept;
+
+  [[nodiscard]] size_t names_count() const noexcept {
+    return names.size();
+  }
+
+  [[nodiscard]] learned_policy_snapshot export_stats() const;
+
+  // replaces stats of names from 'snapshot', names over 'max_names' are ignored
+  void import_stats(const learned_policy_snapshot& snapshot);
+
+  void reset() noexcept {
+    names.clear();
+  }
+};
+
+// same as encode_headers_block, but indexing and huffman are chosen per header by 'policy'
+template <Out O>
+O encode_headers_block_learned(encoder& enc, learned_policy& policy, auto&& range_of_headers, O out) {
+  for (auto&& [name, value] : range_of_headers) {
+    header_decision d = policy.observe(name, value);
+    if (d.index && d.huffman)
+      out = enc.encode<true, true>(name, value, out);
+    else if (d.index)
+      out = enc.encode<true, false>(name, value, out);
+    else if (d.huffman)
+      out = enc.encode<false, true>(name, value, out);
+    else
+      out = enc.encode<false, false>(name, value, out);
+  }
+  return out;
+}
+
+// learned stats per peer (origin, client id), so encoder of new connection to same peer
+// makes good decisions from first request. Bounded, least recently used peers are dropped.
+// Thread safe
+struct learned_policy_cache {
+ private:
+  using snapshot_ptr = std::shared_ptr<const learned_policy_snapshot>;
+  // most recently used first
+  using lru_t = std::list<std::pair<std::string, snapshot_ptr>>;
+
+  mutable std::mutex mtx;
+  size_t max_peers;
+  lru_t lru;
+  // keys point into strings of 'lru'
+  std::unordered_map<std::string_view, lru_t::iterator> peers;
+
+ public:
+  explicit learned_policy_cache(size_t max_peers = 1024) : max_peers(max_peers) {
+  }
+
+  learned_policy_cache(learned_policy_cache&&) = delete;
+  void operator=(learned_policy_cache&&) = delete;
+
+  // e.g. when connection closed
+  void store(std::string_view peer, learned_policy_snapshot snapshot);
+  void store(std::string_view peer, const learned_policy& policy) {
+    store(peer, policy.export_stats());
+  }
+
+  // imports stats of 'peer' into 'policy', returns false if there are no stats of 'peer'
+  bool load(std::string_view peer, learned_policy& policy);
+
+  void erase(std::string_view peer);
+
+  [[nodiscard]] size_t size() const;
+};
+
+}  // namespace hpack
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+// decoding of one connection split between two threads:
+// producer (network I/O thread) runs cheap structural part of decoding and maintenance of dynamic table,
+// consumer (application thread) finishes lazy work: huffman decoding of literals which are not inserted
+// into table and validation of names.
+// Blocks are passed through lock-free single producer / single consumer ring of fixed capacity,
+// each slot owns arena with strings of its block (copies of table entries and raw literals),
+// so table may change and frame buffer may be reused after push.
+// Arenas of slots are reused, no allocations on steady state
+struct decode_pipeline {
+ private:
+  // string in arena of slot
+  struct lazy_string {
+    uint32_t offset = 0;
+    uint32_t len = 0;
+    bool huffman = false;
+  };
+  struct lazy_header {
+    lazy_string name;
+    lazy_string value;
+  };
+  struct slot_t {
+    uint32_t stream_id = 0;
+    std::vector<byte_t> arena;
+    std::vector<lazy_header> headers;
+  };
+  std::unique_ptr<slot_t[]> slots;
+  size_t mask;
+  // count of pushed blocks, written only by producer
+  alignas(64) std::atomic<size_t> head = 0;
+  // count of released blocks, written only by consumer
+  alignas(64) std::atomic<size_t> tail = 0;
+  // producer side
+  alignas(64) block_decode_buffers producer_buffers;
+  std::vector<char> producer_scratch;
+  // consumer side
+  alignas(64) std::vector<huffman_decode_job> jobs;
+  std::vector<char> decoded;
+  std::vector<table_entry> entries;
+
+  // appends 'str' to arena of slot
+  static lazy_string append(slot_t& slot, std::string_view str, bool huffman);
+  // fills 'entries' from slot
+  void finish_slot(slot_t& slot);
+
+ public:
+  // 'capacity' - max count of blocks in queue, rounded up to power of 2
+  explicit decode_pipeline(size_t capacity = 64);
+
+  decode_pipeline(decode_pipeline&&) = delete;
+  void operator=(decode_pipeline&&) = delete;
+
+  // producer side.
+  // Scans 'bytes', applies them to dynamic table of 'dec' (literals with incremental indexing
+  // are huffman decoded here, table needs them), pushes block into queue.
+  // Returns false if queue is full, nothing changed then, block must be pushed later.
+  // Protocol error if block is malformed, nothing pushed then (table may be changed, connection is broken)
+  bool try_push(decoder& dec, uint32_t stream_id, std::span<const byte_t> bytes);
+
+  // consumer side.
+  // Finishes oldest block, calls 'visitor(uint32_t stream_id, std::span<const table_entry> headers)',
+  // then releases its slot. Returns false if queue is empty.
+  // Protocol error if huffman string of block is malformed or name contains uppercase characters,
+  // block is released, connection should be closed as for errors of producer
+  template <typename V>
+  bool try_pop(V&& visitor) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+    struct release_t {
+      std::atomic<size_t>& tail;
+      size_t next;
+      ~release_t() {
+        tail.store(next, std::memory_order_release);
+      }
+    } release{tail, t + 1};
+    slot_t& slot = slots[t & mask];
+    finish_slot(slot);
+    visitor(slot.stream_id, std::span<const table_entry>(entries));
+    return true;
+  }
+
+  // approximate if called concurrently with push / pop
+  [[nodiscard]] size_t size() const noexcept {
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] size_t capacity() const noexcept {
+    return mask + 1;
+  }
+};
+
+}  // namespace hpack
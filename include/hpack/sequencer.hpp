@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hpack/hpack.hpp"
+
+namespace hpack {
+
+// connection level queue of header lists for one encoder.
+// Any thread may .submit() (lock-free), only one thread at a time (consumer)
+// may .drain(), it is the only thread which touches encoder,
+// so no mutex around encoder required
+struct encode_sequencer {
+  using header_list = std::vector<std::pair<std::string, std::string>>;
+
+ private:
+  struct node_t {
+    node_t* next = nullptr;
+    uint32_t stream_id = 0;
+    header_list headers;
+  };
+  std::atomic<node_t*> head = nullptr;
+  // consumer side
+  std::vector<byte_t> buffer;
+  std::vector<size_t> block_ends;
+
+  // takes all submitted nodes, returns them in submission order
+  node_t* take_all() noexcept;
+  static void destroy(node_t* list) noexcept;
+
+ public:
+  encode_sequencer() = default;
+  encode_sequencer(encode_sequencer&&) = delete;
+  void operator=(encode_sequencer&&) = delete;
+  ~encode_sequencer();
+
+  // thread safe, lock-free (except allocation of queue node)
+  // headers are moved into queue, so producer does not wait for encoding
+  void submit(uint32_t stream_id, header_list headers);
+
+  // encodes all submitted header lists in order of submission, all into one buffer,
+  // then calls 'on_block(stream_id, std::span<const byte_t> block)' for each in same order
+  // returns count of encoded blocks
+  // If encoding or 'on_block' throws, exception is propagated and all taken header lists are dropped,
+  // including blocks already encoded but not delivered. Their entries are already in encoder table,
+  // so peer's decoder will not match it: HPACK context is unusable, connection must be closed
+  // precondition: no other thread drains this sequencer concurrently
+  template <bool Cache = true, bool Huffman = false, typename F>
+  size_t drain(encoder& enc, F&& on_block) {
+    node_t* list = take_all();
+    if (!list)
+      return 0;
+    buffer.clear();
+    block_ends.clear();
+    try {
+      for (node_t* n = list; n; n = n->next) {
+        encode_headers_block<Cache, Huffman>(enc, n->headers, std::back_inserter(buffer));
+        block_ends.push_back(buffer.size());
+      }
+      size_t begin = 0;
+      size_t i = 0;
+      for (node_t* n = list; n; n = n->next, ++i) {
+        on_block(n->stream_id, std::span<const byte_t>(buffer.data() + begin, block_ends[i] - begin));
+        begin = block_ends[i];
+      }
+    } catch (...) {
+      destroy(list);
+      throw;
+    }
+    destroy(list);
+    return block_ends.size();
+  }
+
+  // approximate, only for diagnostics
+  [[nodiscard]] bool empty() const noexcept {
+    return head.load(std::memory_order_relaxed) == nullptr;
+  }
+};
+
+}  // namespace hpack
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <string_view>
+
+#include "hpack/basic_types.hpp"
+#include "hpack/static_table.hpp"
+
+namespace hpack {
+
+// process-wide pre-encoded header with often changing value (date, server-timing),
+// encoded as literal without indexing with indexed name and huffman value.
+// Value is updated once per tick by any thread, all encoders only copy bytes,
+// so dynamic tables are not touched and value is not re-encoded on each connection
+struct shared_encoded_header {
+  // max size of whole encoded representation
+  static constexpr size_t max_encoded_size = 128;
+
+ private:
+  static constexpr size_t words_count = max_encoded_size / sizeof(uint64_t);
+
+  // seqlock, odd while updating
+  std::atomic<uint64_t> seq = 0;
+  std::atomic<uint64_t> _tick = 0;
+  std::atomic<uint64_t> size = 0;
+  std::atomic<uint64_t> words[words_count] = {};
+  index_type name_index;
+
+ public:
+  // precondition: 'name' is in static table
+  explicit shared_encoded_header(index_type name) noexcept : name_index(name) {
+    assert(name != 0 && name < static_table_t::first_unused_index);
+  }
+  shared_encoded_header(shared_encoded_header&&) = delete;
+  void operator=(shared_encoded_header&&) = delete;
+
+  // tick of currently published value, 0 if nothing published
+  [[nodiscard]] uint64_t tick() const noexcept {
+    return _tick.load(std::memory_order_acquire);
+  }
+
+  // encodes and publishes 'value' for 'tick',
+  // returns false if other thread publishes now or encoded value is too big
+  bool publish(uint64_t tick, std::string_view value);
+
+  // copies consistent encoded representation into 'out' and returns its size
+  // returns 0 if nothing published
+  // 'out' must have at least max_encoded_size bytes
+  size_t load(byte_t* out) const noexcept;
+
+  template <Out O>
+  O encode(O out) const {
+    byte_t buf[max_encoded_size];
+    size_t sz = load(buf);
+    return std::copy_n(buf, sz, out);
+  }
+};
+
+// process-wide 'date' header (static index 33) with value for current second,
+// value is formatted and encoded only once per second for all threads
+[[nodiscard]] shared_encoded_header& shared_date_header() noexcept;
+
+// publishes current date into shared_date_header() if second changed since last publish
+void refresh_shared_date_header();
+
+// writes 'date' header with current time,
+// same bytes as encoder::encode_header_without_indexing<true>(static_table_t::date, <date>, out)
+template <Out O>
+O encode_date_header(O out) {
+  refresh_shared_date_header();
+  return shared_date_header().encode(out);
+}
+
+// formats IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") for seconds since epoch,
+// 'out' must have at least 29 bytes, returns count of written bytes
+size_t format_http_date(int64_t seconds_since_epoch, char* out) noexcept;
+
+}  // namespace hpack
@@ -25,6 +25,9 @@ struct static_table_t {
   // precondition: index < first_unused_index && index != 0
   // .value empty if no cached
   static table_entry get_entry(index_type index);
+
+  // all entries of static table by index, [0] is empty
+  static const table_entry entries[];
 };
 
 }  // namespace hpack
@@ -1,43 +1,49 @@
 #pragma once
 
 #include <algorithm>
+#include <span>
+#include <type_traits>
 
 #include "hpack/basic_types.hpp"
+#include "hpack/huffman.hpp"
 #include "hpack/integers.hpp"
 
 namespace hpack {
 
+namespace noexport {
+
+// writes huffman codes of concatenation of 'chunks' with padding, without length
+template <typename O>
+O huffman_encode_chunks(std::span<const std::string_view> chunks, O out) {
+  huffman_encoder_state state;
+  if constexpr (std::is_pointer_v<O>) {
+    for (std::string_view str : chunks)
+      out = huffman_encode_chunk(str, state, out);
+    return huffman_encode_finish(state, out);
+  } else {
+    // by chunks through buffer, long enough for avx2 encoding
+    constexpr size_t chunk = 128;
+    byte_t buf[max_huffman_chunk_size(chunk)];
+    for (std::string_view str : chunks) {
+      for (size_t i = 0; i < str.size(); i += chunk) {
+        byte_t* e = huffman_encode_chunk(str.substr(i, chunk), state, buf);
+        out = std::copy(buf, e, out);
+      }
+    }
+    return std::copy(buf, huffman_encode_finish(state, buf), out);
+  }
+}
+
+}  // namespace noexport
+
 template <Out O>
 O encode_string_huffman(std::string_view str, O _out) {
   auto out = noexport::adapt_output_iterator(_out);
   // precalculate size
   // (size should be before string and len in bits depends on 'len' value)
-  size_type len_after_encode = 0;
-  for (char c : str)
-    len_after_encode += huffman_table[uint8_t(c)].bit_count;
   *out = 0b1000'0000;  // set H bit
-  const int padlen = 8 - len_after_encode % 8;
-  out = encode_integer((len_after_encode + padlen) / 8, 7, out);
-  auto push_bit = [&, bitn = 7](bool bit) mutable {
-    if (bitn == 7)
-      *out = 0;
-    *out |= (bit << bitn);
-    if (bitn == 0) {
-      ++out;
-      bitn = 7;
-      // not set out to 0, because may be end
-    } else {
-      --bitn;
-    }
-  };
-  for (char c : str) {
-    sym_info_t bits = huffman_table[uint8_t(c)];
-    for (int i = 0; i < bits.bit_count; ++i)
-      push_bit(bits.bits & (1 << i));
-  }
-  // padding MUST BE formed from EOS la-la-la (just 111..)
-  for (int i = 0; i < padlen; ++i)
-    push_bit(true);
+  out = encode_integer(huffman_encoded_size(str), 7, out);
+  out = noexport::huffman_encode_chunks(std::span(&str, 1), out);
   return noexport::unadapt<O>(out);
 }
 
@@ -62,6 +68,27 @@ O encode_string(std::string_view str, O _out) {
   return noexport::unadapt<O>(out);
 }
 
+// same as encode_string for concatenation of 'chunks' (e.g. big value produced by parts),
+// chunks are written directly into 'out' without concatenating them
+template <bool Huffman = false, Out O>
+O encode_string_chunks(std::span<const std::string_view> chunks, O _out) {
+  auto out = noexport::adapt_output_iterator(_out);
+  if constexpr (!Huffman) {
+    size_t len = 0;
+    for (std::string_view str : chunks)
+      len += str.size();
+    *out = 0;  // set H bit to 0
+    out = encode_integer(len, 7, out);
+    for (std::string_view str : chunks)
+      out = std::copy_n(str.data(), str.size(), out);
+  } else {
+    *out = 0b1000'0000;  // set H bit
+    out = encode_integer(huffman_encoded_size(chunks), 7, out);
+    out = noexport::huffman_encode_chunks(chunks, out);
+  }
+  return noexport::unadapt<O>(out);
+}
+
 // in decoder.hpp
 struct decoded_string;
 
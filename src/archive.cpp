@@ -0,0 +1,174 @@
+
+#include "hpack/archive.hpp"
+
+#include <algorithm>
+
+namespace hpack {
+
+namespace {
+
+constexpr byte_t file_magic[4] = {'H', 'P', 'K', 'A'};
+constexpr byte_t index_magic[4] = {'H', 'P', 'K', 'I'};
+constexpr byte_t format_version = 1;
+// segments_count(u32) index_offset(u64) magic
+constexpr size_t trailer_size = 4 + 8 + 4;
+// offset(u64) first_record(u64) records_count(u32)
+constexpr size_t index_entry_size = 8 + 8 + 4;
+
+template <typename T>
+void put_le(std::vector<byte_t>& out, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i)
+    out.push_back(byte_t(value >> (8 * i)));
+}
+
+template <typename T>
+T get_le(std::span<const byte_t> bytes, size_t pos) {
+  if (bytes.size() < pos || bytes.size() - pos < sizeof(T))
+    handle_protocol_error();
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i)
+    value |= T(bytes[pos + i]) << (8 * i);
+  return value;
+}
+
+}  // namespace
+
+archive_writer::archive_writer(sink_t s, archive_writer_options o)
+    : sink(std::move(s)), opts(std::move(o)), enc(opts.table_size) {
+  assert(sink && opts.records_per_segment > 0);
+  std::vector<byte_t> header(file_magic, file_magic + 4);
+  header.push_back(format_version);
+  header.insert(header.end(), 3, 0);
+  put_le<uint32_t>(header, opts.table_size);
+  std::vector<byte_t> seed;
+  encoder seed_enc(opts.table_size);
+  for (auto& [name, value] : opts.seed)
+    seed_enc.encode_header_and_cache(name, value, std::back_inserter(seed));
+  put_le<uint32_t>(header, seed.size());
+  header.insert(header.end(), seed.begin(), seed.end());
+  write(header);
+  start_segment();
+}
+
+void archive_writer::write(std::span<const byte_t> bytes) {
+  sink(bytes);
+  offset += bytes.size();
+}
+
+void archive_writer::start_segment() {
+  enc = encoder(opts.table_size);
+  for (auto& [name, value] : opts.seed)
+    enc.dyntab.add_entry(name, value);
+  payload.clear();
+  segment_records = 0;
+}
+
+void archive_writer::flush_segment() {
+  if (segment_records == 0)
+    return;
+  segments.push_back({offset, records - segment_records, uint32_t(segment_records)});
+  std::vector<byte_t> header;
+  put_le<uint32_t>(header, segment_records);
+  put_le<uint32_t>(header, payload.size());
+  write(header);
+  write(payload);
+}
+
+void archive_writer::commit_record() {
+  auto out = std::back_inserter(payload);
+  out = encode_integer(record.size(), 8, out);
+  payload.insert(payload.end(), record.begin(), record.end());
+  ++segment_records;
+  ++records;
+  if (segment_records == opts.records_per_segment) {
+    flush_segment();
+    start_segment();
+  }
+}
+
+void archive_writer::finish() {
+  assert(!finished);
+  flush_segment();
+  std::vector<byte_t> index;
+  for (const segment_info& s : segments) {
+    put_le<uint64_t>(index, s.offset);
+    put_le<uint64_t>(index, s.first_record);
+    put_le<uint32_t>(index, s.records_count);
+  }
+  put_le<uint32_t>(index, segments.size());
+  put_le<uint64_t>(index, offset);
+  index.insert(index.end(), index_magic, index_magic + 4);
+  write(index);
+  finished = true;
+}
+
+archive_reader::archive_reader(std::span<const byte_t> f) : file(f) {
+  // header
+  if (file.size() < 16 || !std::equal(file_magic, file_magic + 4, file.begin()) ||
+      file[4] != format_version)
+    handle_protocol_error();
+  table_size = get_le<uint32_t>(file, 8);
+  uint32_t seed_size = get_le<uint32_t>(file, 12);
+  if (file.size() - 16 < seed_size)
+    handle_protocol_error();
+  decoder seed_dec(table_size);
+  decode_headers_block(seed_dec, file.subspan(16, seed_size), [&](std::string_view name, std::string_view value) {
+    seed.emplace_back(name, value);
+  });
+  const size_t data_begin = 16 + seed_size;
+
+  // index
+  if (file.size() - data_begin < trailer_size)
+    handle_protocol_error();
+  const size_t trailer = file.size() - trailer_size;
+  if (!std::equal(index_magic, index_magic + 4, file.begin() + trailer + 12))
+    handle_protocol_error();
+  uint32_t count = get_le<uint32_t>(file, trailer);
+  uint64_t index_offset = get_le<uint64_t>(file, trailer + 4);
+  if (index_offset < data_begin || index_offset > trailer ||
+      (trailer - index_offset) != uint64_t(count) * index_entry_size)
+    handle_protocol_error();
+  data_end = index_offset;
+  segments.reserve(count);
+  uint64_t next_record = 0;
+  uint64_t min_offset = data_begin;
+  for (uint32_t i = 0; i < count; ++i) {
+    size_t pos = index_offset + i * index_entry_size;
+    segment_info s{
+        .offset = get_le<uint64_t>(file, pos),
+        .first_record = get_le<uint64_t>(file, pos + 8),
+        .records_count = get_le<uint32_t>(file, pos + 16),
+    };
+    // segments in order, each has at least its header
+    if (s.first_record != next_record || s.records_count == 0 || s.offset < min_offset ||
+        s.offset > index_offset || index_offset - s.offset < 8)
+      handle_protocol_error();
+    next_record += s.records_count;
+    min_offset = s.offset + 8;
+    segments.push_back(s);
+  }
+}
+
+void archive_reader::sync(decoder& dec) const {
+  // entries are freed, but vector of entries is kept, so reads of same size do not reallocate it.
+  // Size updates in segment may lower max size, it cannot be raised back, so only then recreated
+  if (dec.dyntab.max_size() == table_size)
+    dec.dyntab.reset();
+  else
+    dec = decoder(table_size, dec.dyntab.get_resource());
+  for (auto& [name, value] : seed)
+    dec.dyntab.add_entry(name, value);
+}
+
+std::span<const byte_t> archive_reader::segment_payload(size_t i) const {
+  const segment_info& s = segments[i];
+  if (get_le<uint32_t>(file, s.offset) != s.records_count)
+    handle_protocol_error();
+  uint32_t size = get_le<uint32_t>(file, s.offset + 4);
+  size_t end = i + 1 < segments.size() ? segments[i + 1].offset : data_end;
+  if (end - (s.offset + 8) < size)
+    handle_protocol_error();
+  return file.subspan(s.offset + 8, size);
+}
+
+}  // namespace hpack
@@ -0,0 +1,177 @@
+
+#include "hpack/connection.hpp"
+
+#include <algorithm>
+
+namespace hpack {
+
+namespace {
+
+// representations in block, for which scratch is reserved
+size_t block_headers_for(const connection_context_options& opts) noexcept {
+  return std::min(opts.max_block_headers, opts.max_block_size);
+}
+
+// memory after slab, there is no such memory in no heap mode
+std::pmr::memory_resource* overflow_resource(const connection_context_options& opts,
+                                             std::pmr::memory_resource* upstream) noexcept {
+  return opts.no_heap ? std::pmr::null_memory_resource() : upstream;
+}
+
+}  // namespace
+
+namespace noexport {
+
+void* slab_resource::do_allocate(size_t bytes, size_t align) {
+  const size_t size = block_size(bytes);
+  if (align > alignof(std::max_align_t)) [[unlikely]]
+    return upstream->allocate(size, align);
+  free_block*& list = free_lists[std::countr_zero(size) - min_block_log2];
+  if (list) {
+    free_block* b = list;
+    list = b->next;
+    return b;
+  }
+  if (size_t(end - cur) >= size) {
+    void* p = cur;
+    cur += size;
+    return p;
+  }
+  return upstream->allocate(size, align);
+}
+
+void slab_resource::do_deallocate(void* p, size_t bytes, size_t align) {
+  const size_t size = block_size(bytes);
+  if (p < begin || p >= end || align > alignof(std::max_align_t)) {
+    upstream->deallocate(p, size, align);
+    return;
+  }
+  free_block*& list = free_lists[std::countr_zero(size) - min_block_log2];
+  list = new (p) free_block{list};
+}
+
+void* ring_resource::do_allocate(size_t bytes, size_t align) {
+  if (align > alignof(block_header)) [[unlikely]]
+    return upstream->allocate(bytes, align);
+  if (!sealed) {
+    const size_t size = round_up(bytes);
+    if (size_t(end - ring_begin) < size)
+      return upstream->allocate(bytes, align);
+    void* p = ring_begin;
+    ring_begin += size;
+    head = tail = ring_begin;
+    return p;
+  }
+  const size_t size = sizeof(block_header) + round_up(bytes);
+  byte_t* p;
+  if (wrap) {
+    // free space is [head, tail)
+    if (size_t(tail - head) < size)
+      return upstream->allocate(bytes, align);
+    p = head;
+  } else if (size_t(end - head) >= size) {
+    p = head;
+  } else if (size_t(tail - ring_begin) >= size) {
+    wrap = head;
+    p = ring_begin;
+  } else {
+    return upstream->allocate(bytes, align);
+  }
+  head = p + size;
+  new (p) block_header{size, false};
+  return p + sizeof(block_header);
+}
+
+void ring_resource::do_deallocate(void* p, size_t bytes, size_t align) {
+  if (p < begin || p >= end || align > alignof(block_header)) {
+    upstream->deallocate(p, bytes, align);
+    return;
+  }
+  if (p < ring_begin)  // permanent
+    return;
+  ((block_header*)p - 1)->freed = true;
+  reclaim();
+}
+
+void ring_resource::reclaim() noexcept {
+  // ring is empty if tail == head and there is no wrap
+  while (tail != head || wrap) {
+    if (tail == wrap) {
+      tail = ring_begin;
+      wrap = nullptr;
+      continue;
+    }
+    block_header* h = (block_header*)tail;
+    if (!h->freed)
+      return;
+    tail += h->size;
+  }
+  // empty, start from beginning, so next blocks do not wrap
+  head = tail = ring_begin;
+}
+
+}  // namespace noexport
+
+using noexport::ring_resource;
+using noexport::slab_resource;
+
+size_t connection_context::slab_size_for(const connection_context_options& opts) noexcept {
+  const size_t headers = block_headers_for(opts);
+  const size_t scratch =
+      slab_resource::block_size(max_huffman_string_size_after_decode(opts.max_block_size) + 2 * headers) +
+      slab_resource::block_size(headers * sizeof(header_representation)) +
+      slab_resource::block_size(2 * headers * sizeof(huffman_decode_job)) +
+      slab_resource::block_size(opts.decoder_table_size + 1);
+  return ring_resource::size_for_table(opts.encoder_table_size) +
+         ring_resource::size_for_table(opts.decoder_table_size) + scratch;
+}
+
+connection_context::slab_t::slab_t(std::pmr::memory_resource* up, size_t sz)
+    : upstream(up ? up : std::pmr::get_default_resource()),
+      size(sz),
+      data(upstream->allocate(size, alignof(std::max_align_t))) {
+}
+
+connection_context::slab_t::~slab_t() {
+  upstream->deallocate(data, size, alignof(std::max_align_t));
+}
+
+connection_context::connection_context(const connection_context_options& opts)
+    : slab(opts.upstream, slab_size_for(opts)),
+      encoder_entries(slab.data, ring_resource::size_for_table(opts.encoder_table_size),
+                      overflow_resource(opts, slab.upstream)),
+      decoder_entries((byte_t*)slab.data + ring_resource::size_for_table(opts.encoder_table_size),
+                      ring_resource::size_for_table(opts.decoder_table_size),
+                      overflow_resource(opts, slab.upstream)),
+      pool((byte_t*)slab.data + ring_resource::size_for_table(opts.encoder_table_size) +
+               ring_resource::size_for_table(opts.decoder_table_size),
+           slab.size - ring_resource::size_for_table(opts.encoder_table_size) -
+               ring_resource::size_for_table(opts.decoder_table_size),
+           overflow_resource(opts, slab.upstream)),
+      max_block_size(opts.no_heap ? opts.max_block_size : 0),
+      enc(opts.encoder_table_size, &encoder_entries),
+      dec(opts.decoder_table_size, &decoder_entries),
+      buffers(&pool) {
+  // vectors of entries never grow, they are before ring
+  enc.dyntab.reserve_entries(ring_resource::max_entries(opts.encoder_table_size));
+  dec.dyntab.reserve_entries(ring_resource::max_entries(opts.decoder_table_size));
+  encoder_entries.seal();
+  decoder_entries.seal();
+  if (opts.no_heap) {
+    // packed content would not fit into ring together with entries
+    enc.dyntab.disable_hibernation();
+    dec.dyntab.disable_hibernation();
+  }
+  // scratch allocated once, enough for blocks up to 'max_block_size' and 'max_block_headers'
+  const size_t headers = block_headers_for(opts);
+  buffers.headers.reserve(headers);
+  // name and value of each header
+  buffers.jobs.reserve(2 * headers);
+  // one byte for each string may be written after decoded string
+  buffers.decoded.resize(max_huffman_string_size_after_decode(opts.max_block_size) + 2 * headers);
+  buffers.evicted_name.reserve(opts.decoder_table_size);
+  if (opts.no_heap)
+    buffers.max_headers = headers;
+}
+
+}  // namespace hpack
@@ -1,9 +1,13 @@
 
+#include <algorithm>
 #include <charconv>
 #include <bit>
+#include <cstring>
+#include <new>
 
 #include "hpack/integers.hpp"
 #include "hpack/decoder.hpp"
+#include "hpack/huffman.hpp"
 
 namespace {
 
@@ -24,93 +28,48 @@ scope_fail(T) -> scope_fail<T>;
 
 namespace hpack {
 
-[[nodiscard]] constexpr static size_t max_huffman_string_size_after_decode(
-    size_type huffman_str_len) noexcept {
-  // minimal symbol in table is 5 bit len, so worst case is only 5 bit symbols
-  return size_t(huffman_str_len) * 8 / 5;
-}
-
-// uint16_t(-1) if not found
-uint16_t huffman_decode_table_find(sym_info_t info);
-
-// precondition: in != e
-// note: 'len' must be decoded before calling this function
-template <Out O>
-static O decode_string_huffman(In in, size_type len, O out) {
-  In e = in + len;
-  sym_info_t info{0, 0};
-  int bit_nmb = 0;
-  auto next_bit = [&] {
-    bool bit = *in & (0b1000'0000 >> bit_nmb);
-    if (bit_nmb == 7) {
-      bit_nmb = 0;
-      ++in;
-    } else {
-      ++bit_nmb;
-    }
-    return bit;
-  };
-  for (;;) {
-    // min symbol len in Huffman table is 5 bits
-    for (int i = 0; in != e && i < 5; ++i, ++info.bit_count) {
-      info.bits <<= 1;
-      info.bits += next_bit();
-    }
-    uint16_t sym;
-    while ((sym = huffman_decode_table_find(info)) == uint16_t(-1) && in != e) {
-      info.bits <<= 1;
-      info.bits += next_bit();
-      ++info.bit_count;
-    }
-    if (sym == 256) [[unlikely]] {
-      // EOS
-      while (bit_nmb != 0)  // skip padding
-        next_bit();
-      return out;
-    }
-    if (sym != uint16_t(-1)) {
-      info = {};
-      *out = byte_t(sym);
-      ++out;
-    }
-    if (in == e) {
-      if (std::countr_one(info.bits) != info.bit_count)
-        handle_protocol_error();  // incorrect padding
-      return out;
-    }
-  }
-  return out;
-}
-
 void decoded_string::set_huffman(const char* ptr, size_type len) {
-  // also handles case when len == 0
+  if (len == 0) {
+    // keep allocated memory for next strings
+    if (!allocated_sz_log2)
+      data = nullptr;
+    sz = 0;
+    return;
+  }
   if (bytes_allocated() >= max_huffman_string_size_after_decode(len)) {
     const byte_t* in = (const byte_t*)ptr;
     // const cast because im owner of pointer (its allocated by malloc)
-    char* end = decode_string_huffman(in, len, const_cast<char*>(data));
-    sz = end - data;
+    sz = huffman_decode(in, len, const_cast<char*>(data));
 
     assert(sz <= max_huffman_string_size_after_decode(sz));
   } else {
-    size_t sz_to_allocate = std::bit_ceil(max_huffman_string_size_after_decode(len));
-    allocated_sz_log2 = std::bit_width(sz_to_allocate) - 1;
+    // at least 2, because allocated_sz_log2 == 0 means 'not allocated'
+    size_t sz_to_allocate = std::max<size_t>(2, std::bit_ceil(max_huffman_string_size_after_decode(len)));
+    const uint8_t old_sz_log2 = std::exchange(allocated_sz_log2, std::bit_width(sz_to_allocate) - 1);
     const char* old_data = data;
     data = (char*)malloc(sz_to_allocate);
+    if (!data) {
+      data = old_data;
+      allocated_sz_log2 = old_sz_log2;
+      throw std::bad_alloc{};
+    }
 
     scope_fail free_mem{[&] {
       free((void*)data);
       data = old_data;
-      allocated_sz_log2 = 0;
+      allocated_sz_log2 = old_sz_log2;
     }};
     // recursive call into branch where we have enough memory
     set_huffman(ptr, len);
 
     free_mem.failed = false;
+    if (old_sz_log2)
+      free((void*)old_data);
   }
 }
 
 // decodes partly indexed / new-name pairs
-static void decode_header_impl(In& in, In e, uint8_t N, dynamic_table_t& dyntab, header_view& out) {
+static void decode_header_impl(In& in, In e, uint8_t N, decoder_dynamic_table_t& dyntab, header_view& out) {
   index_type index = decode_integer(in, e, N);
   if (index == 0)
     decode_string(in, e, out.name);
@@ -119,7 +78,7 @@ static void decode_header_impl(In& in, In e, uint8_t N, dynamic_table_t& dyntab,
   decode_string(in, e, out.value);
 }
 
-static void decode_header_fully_indexed(In& in, In e, dynamic_table_t& dyntab, header_view& out) {
+static void decode_header_fully_indexed(In& in, In e, decoder_dynamic_table_t& dyntab, header_view& out) {
   assert(*in & 0b1000'0000);
   index_type index = decode_integer(in, e, 7);
   table_entry entry = get_by_index(index, &dyntab);
@@ -131,18 +90,18 @@ static void decode_header_fully_indexed(In& in, In e, dynamic_table_t& dyntab, h
 }
 
 // header with incremental indexing
-static void decode_header_cache(In& in, In e, dynamic_table_t& dyntab, header_view& out) {
+static void decode_header_cache(In& in, In e, decoder_dynamic_table_t& dyntab, header_view& out) {
   assert(in != e && *in & 0b0100'0000);
   decode_header_impl(in, e, 6, dyntab, out);
   dyntab.add_entry(out.name.str(), out.value.str());
 }
 
-static void decode_header_without_indexing(In& in, In e, dynamic_table_t& dyntab, header_view& out) {
+static void decode_header_without_indexing(In& in, In e, decoder_dynamic_table_t& dyntab, header_view& out) {
   assert(in != e && (*in & 0x1111'0000) == 0);
   return decode_header_impl(in, e, 4, dyntab, out);
 }
 
-static void decode_header_never_indexing(In& in, In e, dynamic_table_t& dyntab, header_view& out) {
+static void decode_header_never_indexing(In& in, In e, decoder_dynamic_table_t& dyntab, header_view& out) {
   assert(in != e && *in & 0b0001'0000);
   return decode_header_impl(in, e, 4, dyntab, out);
 }
@@ -166,6 +125,222 @@ void decode_string(In& in, In e, decoded_string& out) {
   in += str_len;
 }
 
+static std::string_view scan_string(In& in, In e, bool& is_huffman) {
+  if (in == e)
+    handle_size_error();
+  is_huffman = *in & 0b1000'0000;
+  size_type str_len = decode_integer(in, e, 7);
+  if (str_len > std::distance(in, e))
+    handle_size_error();
+  std::string_view str((const char*)in, str_len);
+  in += str_len;
+  return str;
+}
+
+static void scan_literal(In& in, In e, uint8_t N, header_representation& out) {
+  out.index = decode_integer(in, e, N);
+  out.name = {};
+  out.name_huffman = false;
+  if (out.index == 0)
+    out.name = scan_string(in, e, out.name_huffman);
+  out.value = scan_string(in, e, out.value_huffman);
+}
+
+void scan_header(In& in, In e, header_representation& out) {
+  assert(in != e);
+  using enum header_representation::kind_e;
+  if (*in & 0b1000'0000) {
+    out.kind = fully_indexed;
+    out.index = decode_integer(in, e, 7);
+    out.name = out.value = {};
+    out.name_huffman = out.value_huffman = false;
+    return;
+  }
+  if (*in & 0b0100'0000) {
+    out.kind = with_indexing;
+    return scan_literal(in, e, 6, out);
+  }
+  if (*in & 0b0010'0000) {
+    out.kind = size_update;
+    out.index = decode_integer(in, e, 5);
+    out.name = out.value = {};
+    out.name_huffman = out.value_huffman = false;
+    return;
+  }
+  if (*in & 0b0001'0000) {
+    out.kind = never_indexed;
+    return scan_literal(in, e, 4, out);
+  }
+  if ((*in & 0b1111'0000) == 0) {
+    out.kind = without_indexing;
+    return scan_literal(in, e, 4, out);
+  }
+  handle_protocol_error();
+}
+
+void scan_block(std::span<const byte_t> bytes, block_decode_buffers& buf) {
+  buf.headers.clear();
+  buf.jobs.clear();
+  In in = bytes.data();
+  In e = in + bytes.size();
+  size_t decoded_size = 0;
+  while (in != e) {
+    if (buf.headers.size() == buf.max_headers) [[unlikely]]
+      handle_size_error();
+    header_representation& h = buf.headers.emplace_back();
+    scan_header(in, e, h);
+    if (h.name_huffman)
+      decoded_size += max_huffman_string_size_after_decode(h.name.size());
+    if (h.value_huffman)
+      decoded_size += max_huffman_string_size_after_decode(h.value.size());
+  }
+  if (decoded_size == 0)
+    return;
+  if (buf.decoded.size() < decoded_size)
+    buf.decoded.resize(decoded_size);
+  char* out = buf.decoded.data();
+  auto add_job = [&](std::string_view str) {
+    buf.jobs.push_back({.in = (In)str.data(), .len = size_type(str.size()), .out = out});
+    out += max_huffman_string_size_after_decode(str.size());
+  };
+  for (header_representation& h : buf.headers) {
+    if (h.name_huffman)
+      add_job(h.name);
+    if (h.value_huffman)
+      add_job(h.value);
+  }
+}
+
+void finish_block_decode(block_decode_buffers& buf) noexcept {
+  // same order as jobs added
+  auto job = buf.jobs.begin();
+  auto decoded_str = [&] {
+    std::string_view str(job->out, job->decoded_len);
+    ++job;
+    return str;
+  };
+  for (header_representation& h : buf.headers) {
+    if (h.name_huffman) {
+      h.name = decoded_str();
+      h.name_huffman = false;
+    }
+    if (h.value_huffman) {
+      h.value = decoded_str();
+      h.value_huffman = false;
+    }
+  }
+}
+
+void scan_and_decode_block(std::span<const byte_t> bytes, block_decode_buffers& buf) {
+  scan_block(bytes, buf);
+  huffman_decode_interleaved(buf.jobs);
+  finish_block_decode(buf);
+}
+
+size_t split_huffman_jobs(block_decode_buffers& buf, size_t min_bytes_per_task, size_t max_tasks) {
+  buf.task_bounds.clear();
+  size_t total = 0;
+  for (const huffman_decode_job& job : buf.jobs)
+    total += job.len;
+  size_t tasks = std::clamp<size_t>(total / std::max<size_t>(1, min_bytes_per_task), 1, std::max<size_t>(1, max_tasks));
+  // tasks with approximately equal count of bytes
+  const size_t bytes_per_task = total / tasks;
+  buf.task_bounds.push_back(0);
+  size_t acc = 0;
+  for (size_t i = 0; i < buf.jobs.size(); ++i) {
+    acc += buf.jobs[i].len;
+    if (acc >= bytes_per_task && buf.task_bounds.size() < tasks) {
+      buf.task_bounds.push_back(i + 1);
+      acc = 0;
+    }
+  }
+  if (buf.task_bounds.size() == 1 || buf.task_bounds.back() != buf.jobs.size())
+    buf.task_bounds.push_back(buf.jobs.size());
+  return buf.task_bounds.size() - 1;
+}
+
+table_entry decoder::apply(const header_representation& h, block_decode_buffers& buf) {
+  assert(!h.name_huffman && !h.value_huffman);
+  using enum header_representation::kind_e;
+  table_entry entry;
+  switch (h.kind) {
+    case fully_indexed:
+      entry = get_by_index(h.index, &dyntab);
+      // only way to get uncached value is from static table,
+      // in dynamic table empty header value ("") is a cached header
+      if (h.index < static_table_t::first_unused_index && entry.value.empty())
+        handle_protocol_error();
+      return entry;
+    case size_update:
+      dyntab.update_size(h.index);
+      return entry;
+    case with_indexing:
+    case without_indexing:
+    case never_indexed:
+      entry.name = h.index == 0 ? h.name : get_by_index(h.index, &dyntab).name;
+      entry.value = h.value;
+      if (h.kind != with_indexing)
+        return entry;
+      // too big entry empties table, name from table must outlive it
+      if (h.index >= static_table_t::first_unused_index &&
+          entry.name.size() + entry.value.size() + 32 > dyntab.max_size()) [[unlikely]] {
+        buf.evicted_name.assign(entry.name);
+        entry.name = buf.evicted_name;
+      }
+      if (dyntab.add_entry(entry.name, entry.value) == 0)
+        return entry;
+      // name may point into evicted entry, but now it is in newest entry
+      return dyntab.get_entry(static_table_t::first_unused_index);
+  }
+  handle_protocol_error();
+}
+
+// count of first bytes in [in, e) which are one-byte fully indexed representations (1xxxxxxx, but not 0xFF)
+static size_t indexed_run_length(In in, In e) noexcept {
+  In b = in;
+  if constexpr (std::endian::native == std::endian::little) {
+    constexpr uint64_t high_bits = 0x8080'8080'8080'8080;
+    constexpr uint64_t low_bits = 0x0101'0101'0101'0101;
+    // 8 bytes at a time
+    for (; e - in >= 8; in += 8) {
+      uint64_t w;
+      std::memcpy(&w, in, 8);
+      // high bit of byte set if high bit not set in 'w'
+      uint64_t not_indexed = ~w & high_bits;
+      // high bit of byte set if byte is 0xFF (index continues in next bytes),
+      // false positives possible only after first true positive
+      uint64_t inverted = ~w;
+      uint64_t multibyte = (inverted - low_bits) & ~inverted & high_bits;
+      if (uint64_t stop = not_indexed | multibyte)
+        return (in - b) + std::countr_zero(stop) / 8;
+    }
+  }
+  for (; in != e && (*in & 0b1000'0000) && *in != 0xFF; ++in)
+    ;
+  return in - b;
+}
+
+size_t decoder::decode_indexed_run(In& in, In e, std::span<table_entry> out) {
+  size_t n = std::min(indexed_run_length(in, e), out.size());
+  const index_type max_index = dyntab.current_max_index();
+  for (size_t i = 0; i < n; ++i) {
+    index_type index = in[i] & 0b0111'1111;
+    if (index < static_table_t::first_unused_index) {
+      out[i] = static_table_t::entries[index];
+      // 0 index and only way to get uncached value is from static table,
+      // in dynamic table empty header value ("") is a cached header
+      if (out[i].value.empty()) [[unlikely]]
+        handle_protocol_error();
+    } else {
+      if (index > max_index) [[unlikely]]
+        handle_protocol_error();
+      out[i] = dyntab.reference_entry(index);
+    }
+  }
+  in += n;
+  return n;
+}
+
 void decoder::decode_header(In& in, In e, header_view& out) {
   assert(in != e);
   if (*in & 0b1000'0000)
@@ -185,6 +360,45 @@ void decoder::decode_header(In& in, In e, header_view& out) {
   handle_protocol_error();
 }
 
+static uint64_t parse_number(std::string_view str, size_type* digits_count) {
+  uint64_t value;
+  auto [ptr, err] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (str.empty() || err != std::errc{} || ptr != str.data() + str.size())
+    handle_protocol_error();
+  if (digits_count)
+    *digits_count = str.size();
+  return value;
+}
+
+uint64_t decoder::decode_header_number(In& in, In e, header_view& out, size_type* digits_count) {
+  assert(in != e);
+  while ((*in & 0b1110'0000) == 0b0010'0000) {
+    dyntab.update_size(decode_dynamic_table_size_update(in, e));
+    if (in == e)
+      handle_size_error();
+  }
+  // value is required as string for fully indexed and cached headers
+  if (*in & 0b1100'0000) {
+    decode_header(in, e, out);
+    return parse_number(out.value.str(), digits_count);
+  }
+  // without indexing / never indexed
+  index_type index = decode_integer(in, e, 4);
+  if (index == 0)
+    decode_string(in, e, out.name);
+  else
+    out.name = get_by_index(index, &dyntab).name;
+  out.value.reset();
+  bool is_huffman;
+  std::string_view str = scan_string(in, e, is_huffman);
+  if (!is_huffman)
+    return parse_number(str, digits_count);
+  uint64_t value;
+  if (!huffman_decode_number((In)str.data(), str.size(), value, digits_count))
+    handle_protocol_error();
+  return value;
+}
+
 int decoder::decode_response_status(In& in, In e) {
   assert(in != e);
   if (*in & 0b1000'0000) {
@@ -212,15 +426,12 @@ int decoder::decode_response_status(In& in, In e) {
   // first header of response must be required pseudoheader,
   // which is (for response) only one - ":status"
   header_view header;
-  decode_header(in, e, header);
-  std::string_view code = header.value.str();
-  if (header.name.str() != ":status" || code.size() != 3)
-    handle_protocol_error();
-  int status_code;
-  auto [_, err] = std::from_chars(code.data(), code.data() + 3, status_code);
-  if (err != std::errc{})
+  size_type digits;
+  uint64_t status_code = decode_header_number(in, e, header, &digits);
+  // exactly 3 digits (RFC 9110 15), "0200" is not a status code
+  if (header.name.str() != ":status" || digits != 3 || status_code < 100)
     handle_protocol_error();
-  return status_code;
+  return int(status_code);
 }
 
 }  // namespace hpack
@@ -1,17 +1,23 @@
 
 #include "hpack/dynamic_table.hpp"
+#include "hpack/huffman.hpp"
+#include "hpack/strings.hpp"
 
 #include <utility>
-#include <cstring>  // memcpy
+#include <algorithm>
 
 namespace bi = boost::intrusive;
 
 namespace hpack {
 
-struct dynamic_table_t::entry_t : bi::set_base_hook<bi::link_mode<bi::normal_link>> {
+template <bool Searchable>
+struct basic_dynamic_table_t<Searchable>::entry_t
+    : std::conditional_t<Searchable, bi::set_base_hook<bi::link_mode<bi::normal_link>>,
+                         noexport::no_search_index> {
   const size_type name_end;
   const size_type value_end;
   const size_t _insert_c;
+  uint32_t hits = 0;
   char data[];
 
   entry_t(size_type name_len, size_type value_len, size_t insert_c) noexcept
@@ -28,28 +34,39 @@ struct dynamic_table_t::entry_t : bi::set_base_hook<bi::link_mode<bi::normal_lin
     return value_end;
   }
 
-  static entry_t* create(std::string_view name, std::string_view value, size_t insert_c,
-                         std::pmr::memory_resource* resource) {
+  static entry_t* create(std::string_view name, std::span<const std::string_view> value_chunks,
+                         size_t insert_c, std::pmr::memory_resource* resource) {
     assert(resource);
-    void* bytes = resource->allocate(sizeof(entry_t) + name.size() + value.size(), alignof(entry_t));
-    entry_t* e = new (bytes) entry_t(name.size(), value.size(), insert_c);
-    memcpy(+e->data, name.data(), name.size());
-    memcpy(e->data + name.size(), value.data(), value.size());
+    size_t value_len = 0;
+    for (std::string_view chunk : value_chunks)
+      value_len += chunk.size();
+    void* bytes = resource->allocate(sizeof(entry_t) + name.size() + value_len, alignof(entry_t));
+    entry_t* e = new (bytes) entry_t(name.size(), value_len, insert_c);
+    // empty string_view may have nullptr data, which is UB for memcpy
+    char* out = std::copy_n(name.data(), name.size(), +e->data);
+    for (std::string_view chunk : value_chunks)
+      out = std::copy_n(chunk.data(), chunk.size(), out);
     return e;
   }
+  static entry_t* create(std::string_view name, std::string_view value, size_t insert_c,
+                         std::pmr::memory_resource* resource) {
+    return create(name, std::span(&value, 1), insert_c, resource);
+  }
   static void destroy(const entry_t* e, std::pmr::memory_resource* resource) noexcept {
     assert(e && resource);
     std::destroy_at(e);
-    resource->deallocate((void*)e, e->value_end, alignof(entry_t));
+    resource->deallocate((void*)e, sizeof(entry_t) + e->value_end, alignof(entry_t));
   }
 };
 
 // precondition: 'e' now in entries
-index_type dynamic_table_t::indexof(const dynamic_table_t::entry_t& e) const noexcept {
+template <bool Searchable>
+index_type basic_dynamic_table_t<Searchable>::indexof(const entry_t& e) const noexcept {
   return static_table_t::first_unused_index + (_insert_count - e._insert_c);
 }
 
-static size_type entry_size(const dynamic_table_t::entry_t& entry) noexcept {
+template <typename Entry>
+static size_type entry_size(const Entry& entry) noexcept {
   /*
       The size of an entry is the sum of its name's length in octets (as
       defined in Section 5.2), its value's length in octets, and 32.
@@ -59,121 +76,396 @@ static size_type entry_size(const dynamic_table_t::entry_t& entry) noexcept {
   return entry.value_end + 32;
 }
 
-table_entry dynamic_table_t::key_of_entry::operator()(const dynamic_table_t::entry_t& v) const noexcept {
+template <bool Searchable>
+table_entry basic_dynamic_table_t<Searchable>::key_of_entry::operator()(const entry_t& v) const noexcept {
   return {v.name(), v.value()};
 }
 
-dynamic_table_t::dynamic_table_t(size_type max_size, std::pmr::memory_resource* m) noexcept
-    : _current_size(0),
+template <bool Searchable>
+basic_dynamic_table_t<Searchable>::basic_dynamic_table_t(size_type max_size,
+                                                         std::pmr::memory_resource* m) noexcept
+    : entries(m ? m : std::pmr::get_default_resource()),
+      _current_size(0),
       _max_size(max_size),
       _insert_count(0),
       _resource(m ? m : std::pmr::get_default_resource()) {
 }
 
-dynamic_table_t::dynamic_table_t(dynamic_table_t&& other) noexcept
+template <bool Searchable>
+basic_dynamic_table_t<Searchable>::basic_dynamic_table_t(basic_dynamic_table_t&& other) noexcept
     : entries(std::move(other.entries)),
       set(std::move(other.set)),
       _current_size(std::exchange(other._current_size, 0)),
       _max_size(std::exchange(other._max_size, 0)),
       _insert_count(std::exchange(other._insert_count, 0)),
-      _resource(std::exchange(other._resource, std::pmr::get_default_resource())) {
+      _resource(std::exchange(other._resource, std::pmr::get_default_resource())),
+      _hibernated(std::exchange(other._hibernated, nullptr)),
+      _entries_reserved(std::exchange(other._entries_reserved, false)),
+      _hibernation_disabled(std::exchange(other._hibernation_disabled, false)) {
 }
 
-dynamic_table_t& dynamic_table_t::operator=(dynamic_table_t&& other) noexcept {
+template <bool Searchable>
+basic_dynamic_table_t<Searchable>& basic_dynamic_table_t<Searchable>::operator=(
+    basic_dynamic_table_t&& other) noexcept {
   if (this == &other) [[unlikely]]
     return *this;
   reset();
-  entries = std::move(other.entries);
+  // entries vector goes with its resource
+  std::destroy_at(&entries);
+  std::construct_at(&entries, std::move(other.entries));
   set = std::move(other.set);
   _current_size = std::exchange(other._current_size, 0);
   _max_size = std::exchange(other._max_size, 0);
   _insert_count = std::exchange(other._insert_count, 0);
   _resource = std::exchange(other._resource, std::pmr::get_default_resource());
+  _hibernated = std::exchange(other._hibernated, nullptr);
+  _entries_reserved = std::exchange(other._entries_reserved, false);
+  _hibernation_disabled = std::exchange(other._hibernation_disabled, false);
   return *this;
 }
 
-dynamic_table_t::~dynamic_table_t() {
+template <bool Searchable>
+basic_dynamic_table_t<Searchable>::~basic_dynamic_table_t() {
   reset();
 }
 
 // returns index of added pair, 0 if cannot add
-index_type dynamic_table_t::add_entry(std::string_view name, std::string_view value) {
-  size_type new_entry_size = name.size() + value.size() + 32;
+template <bool Searchable>
+index_type basic_dynamic_table_t<Searchable>::add_entry(std::string_view name, std::string_view value) {
+  return add_entry(name, std::span(&value, 1));
+}
+
+template <bool Searchable>
+index_type basic_dynamic_table_t<Searchable>::add_entry(std::string_view name,
+                                                        std::span<const std::string_view> value_chunks) {
+  size_type new_entry_size = name.size() + 32;
+  for (std::string_view chunk : value_chunks)
+    new_entry_size += chunk.size();
   if (_max_size < new_entry_size) [[unlikely]] {
     reset();
     return 0;
   }
+  wake_if_hibernated();
+  // create before evicting, 'name' or 'value_chunks' may point into evicted entry
+  entry_t* e = entry_t::create(name, value_chunks, _insert_count + 1, _resource);
   evict_until_fits_into(_max_size - new_entry_size);
-  entries.push_back(entry_t::create(name, value, ++_insert_count, _resource));
-  set.insert(*entries.back());
+  ++_insert_count;
+  entries.push_back(e);
+  index_insert(*e);
   _current_size += new_entry_size;
   return static_table_t::first_unused_index;
 }
 
-void dynamic_table_t::update_size(size_type new_max_size) {
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::update_size(size_type new_max_size) {
   if (new_max_size > max_size())
     throw protocol_error{};
+  wake_if_hibernated();
   evict_until_fits_into(new_max_size);
   _max_size = new_max_size;
 }
 
-find_result_t dynamic_table_t::find(std::string_view name, std::string_view value) noexcept {
+template <bool Searchable>
+find_result_t basic_dynamic_table_t<Searchable>::find(std::string_view name, std::string_view value) {
+  wake_if_hibernated();
   find_result_t r;
-  auto it = set.find(table_entry{name, value});
-  if (it == set.end())
+  entry_t* found = nullptr;
+  if constexpr (Searchable) {
+    auto it = set.find(table_entry{name, value});
+    if (it != set.end())
+      found = &*it;
+  } else {
+    // newest first
+    auto it = std::find_if(entries.rbegin(), entries.rend(),
+                           [&](const entry_t* e) { return e->name() == name && e->value() == value; });
+    if (it != entries.rend())
+      found = *it;
+  }
+  if (!found)
     return r;
-  if (name == it->name()) {
-    r.header_name_index = indexof(*it);
-    if (value == it->value())
+  if (name == found->name()) {
+    r.header_name_index = indexof(*found);
+    ++found->hits;
+    if (value == found->value())
       r.value_indexed = true;
   }
   return r;
 }
-find_result_t dynamic_table_t::find(index_type name, std::string_view value) noexcept {
+template <bool Searchable>
+find_result_t basic_dynamic_table_t<Searchable>::find(index_type name, std::string_view value) {
   assert(name <= current_max_index());
   find_result_t r;
   if (name < static_table_t::first_unused_index || name > current_max_index() || name == 0)
     return r;
+  wake_if_hibernated();
   table_entry e = get_entry(name);
   if (e.value == value) {
     r.header_name_index = name;
     r.value_indexed = true;
+    ++entry_by_index(name).hits;
     return r;
   }
-  auto it = set.find(table_entry{e.name, value});
-  assert(it != set.end());
-  if (e.name == it->name()) {
-    r.header_name_index = indexof(*it);
-    if (value == it->value())
-      r.value_indexed = true;
-  }
-  return r;
+  return find(e.name, value);
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::index_insert(entry_t& e) {
+  if constexpr (Searchable)
+    set.insert(e);
 }
 
-void dynamic_table_t::reset() noexcept {
-  set.clear();
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::index_erase(entry_t& e) noexcept {
+  if constexpr (Searchable)
+    set.erase(set.s_iterator_to(e));
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::index_clear() noexcept {
+  if constexpr (Searchable)
+    set.clear();
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::reset() noexcept {
+  free_hibernated();
+  index_clear();
   for (entry_t* e : entries)
     entry_t::destroy(e, _resource);
   entries.clear();
   _current_size = 0;
 }
 
-void dynamic_table_t::evict_until_fits_into(size_type bytes) noexcept {
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::evict_until_fits_into(size_type bytes) noexcept {
   assert(bytes <= _max_size);
   size_type i = 0;
   for (; _current_size > bytes; ++i) {
     _current_size -= entry_size(*entries[i]);
-    set.erase(set.s_iterator_to(*entries[i]));
+    index_erase(*entries[i]);
     entry_t::destroy(entries[i], _resource);
   }
   // evicts should be rare operation
   entries.erase(entries.begin(), entries.begin() + i);
 }
 
-table_entry dynamic_table_t::get_entry(index_type index) const noexcept {
-  assert(index >= static_table_t::first_unused_index && index <= current_max_index());
-  auto& e = *(&entries.back() - (index - static_table_t::first_unused_index));
-  return table_entry{e->name(), e->value()};
+template <bool Searchable>
+typename basic_dynamic_table_t<Searchable>::entry_t& basic_dynamic_table_t<Searchable>::entry_by_index(
+    index_type index) const noexcept {
+  assert(index >= static_table_t::first_unused_index && index <= current_max_index() && !_hibernated);
+  return **(&entries.back() - (index - static_table_t::first_unused_index));
+}
+
+template <bool Searchable>
+table_entry basic_dynamic_table_t<Searchable>::get_entry(index_type index) const noexcept {
+  if (index < static_table_t::first_unused_index || index > current_max_index() || _hibernated) [[unlikely]]
+    return {};
+  const entry_t& e = entry_by_index(index);
+  return table_entry{e.name(), e.value()};
+}
+
+template <bool Searchable>
+table_entry basic_dynamic_table_t<Searchable>::reference_entry(index_type index) {
+  wake_if_hibernated();
+  entry_t& e = entry_by_index(index);
+  ++e.hits;
+  return table_entry{e.name(), e.value()};
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::prefetch_slot(index_type index) const noexcept {
+  if (index < static_table_t::first_unused_index || index > current_max_index() || _hibernated)
+    return;
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(&entries.back() - (index - static_table_t::first_unused_index));
+#endif
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::prefetch(index_type index) const noexcept {
+  if (index < static_table_t::first_unused_index || index > current_max_index() || _hibernated)
+    return;
+#if defined(__GNUC__) || defined(__clang__)
+  const entry_t* e = &entry_by_index(index);
+  __builtin_prefetch(e);
+  // name and value are usually in first cache lines of entry
+  __builtin_prefetch(reinterpret_cast<const char*>(e) + 64);
+#endif
+}
+
+template <bool Searchable>
+dyntab_entry_stats basic_dynamic_table_t<Searchable>::entry_stats(index_type index) const noexcept {
+  if (index < static_table_t::first_unused_index || index > current_max_index() || _hibernated) [[unlikely]]
+    return {};
+  const entry_t& e = entry_by_index(index);
+  return dyntab_entry_stats{
+      .index = index,
+      .size = entry_size(e),
+      .insert_number = e._insert_c,
+      .hits = e.hits,
+      .name = e.name(),
+      .value = e.value(),
+  };
+}
+
+template <bool Searchable>
+dyntab_snapshot basic_dynamic_table_t<Searchable>::snapshot() const {
+  dyntab_snapshot s;
+  s.current_size = _current_size;
+  s.max_size = _max_size;
+  s.insert_count = _insert_count;
+  s.entries.reserve(entries_count());
+  if (_hibernated) {
+    // read from packed content, table stays hibernated
+    // (ordered by index, as for not hibernated table)
+    index_type index = current_max_index();
+    unpack(*_hibernated, [&](uint32_t hits, std::string_view name, std::string_view value) {
+      s.entries.push_back({
+          .index = index,
+          .size = size_type(name.size() + value.size() + 32),
+          .insert_number = _insert_count - (index - static_table_t::first_unused_index),
+          .hits = hits,
+          .name = std::string(name),
+          .value = std::string(value),
+      });
+      --index;
+    });
+    std::reverse(s.entries.begin(), s.entries.end());
+    return s;
+  }
+  for (index_type i = static_table_t::first_unused_index; i <= current_max_index(); ++i) {
+    dyntab_entry_stats e = entry_stats(i);
+    s.entries.push_back({
+        .index = e.index,
+        .size = e.size,
+        .insert_number = e.insert_number,
+        .hits = e.hits,
+        .name = std::string(e.name),
+        .value = std::string(e.value),
+    });
+  }
+  return s;
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::hibernate(bool compress) {
+  if (_hibernation_disabled) [[unlikely]]
+    handle_size_error();
+  if (_hibernated)
+    return;
+  auto use_huffman = [&](std::string_view str) { return compress && huffman_encoded_size(str) < str.size(); };
+  std::pmr::vector<byte_t> packed(_resource);
+  packed.reserve(_current_size);
+  auto out = std::back_inserter(packed);
+  for (const entry_t* e : entries) {
+    out = encode_integer(e->hits, 8, out);
+    for (std::string_view str : {e->name(), e->value()}) {
+      if (use_huffman(str))
+        out = encode_string<true>(str, out);
+      else
+        out = encode_string<false>(str, out);
+    }
+  }
+  void* bytes = _resource->allocate(sizeof(hibernated_t) + packed.size(), alignof(hibernated_t));
+  hibernated_t* h = new (bytes) hibernated_t{packed.size(), size_type(entries.size())};
+  std::copy_n(packed.data(), packed.size(), +h->data);
+  index_clear();
+  for (entry_t* e : entries)
+    entry_t::destroy(e, _resource);
+  entries.clear();
+  // releases memory, but not preallocated vector (it may be in permanent memory, see connection_context)
+  if (!_entries_reserved)
+    entries.shrink_to_fit();
+  _hibernated = h;
+}
+
+template <bool Searchable>
+template <typename F>
+void basic_dynamic_table_t<Searchable>::unpack(const hibernated_t& h, F&& f) const {
+  In in = h.data;
+  In e = in + h.size;
+  // for huffman encoded strings
+  std::pmr::string buf[2] = {std::pmr::string(_resource), std::pmr::string(_resource)};
+  auto read_string = [&](std::pmr::string& tmp) -> std::string_view {
+    bool is_huffman = *in & 0b1000'0000;
+    size_type len = decode_integer(in, e, 7);
+    std::string_view str((const char*)in, len);
+    in += len;
+    if (!is_huffman)
+      return str;
+    tmp.resize(max_huffman_string_size_after_decode(len));
+    tmp.resize(huffman_decode((In)str.data(), len, tmp.data()));
+    return tmp;
+  };
+  for (size_type i = 0; i < h.count; ++i) {
+    uint32_t hits = decode_integer(in, e, 8);
+    std::string_view name = read_string(buf[0]);
+    std::string_view value = read_string(buf[1]);
+    f(hits, name, value);
+  }
+  assert(in == e);
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::wake() {
+  if (!_hibernated)
+    return;
+  const hibernated_t& h = *_hibernated;
+  // refilled in place, so preallocated vector is reused
+  assert(entries.empty());
+  try {
+    entries.reserve(h.count);
+    unpack(h, [&](uint32_t hits, std::string_view name, std::string_view value) {
+      entry_t* entry = entry_t::create(name, value, _insert_count - h.count + 1 + entries.size(), _resource);
+      entry->hits = hits;
+      entries.push_back(entry);
+    });
+  } catch (...) {
+    // stays hibernated
+    for (entry_t* entry : entries)
+      entry_t::destroy(entry, _resource);
+    entries.clear();
+    throw;
+  }
+  for (entry_t* entry : entries)
+    index_insert(*entry);
+  free_hibernated();
+}
+
+template <bool Searchable>
+void basic_dynamic_table_t<Searchable>::free_hibernated() noexcept {
+  if (!_hibernated)
+    return;
+  _resource->deallocate(_hibernated, sizeof(hibernated_t) + _hibernated->size, alignof(hibernated_t));
+  _hibernated = nullptr;
+}
+
+template <bool Searchable>
+size_t basic_dynamic_table_t<Searchable>::allocated_bytes() const noexcept {
+  if (_hibernated)
+    return sizeof(hibernated_t) + _hibernated->size;
+  size_t bytes = entries.capacity() * sizeof(entry_t*);
+  for (const entry_t* e : entries)
+    bytes += sizeof(entry_t) + e->size();
+  return bytes;
+}
+
+template struct basic_dynamic_table_t<true>;
+template struct basic_dynamic_table_t<false>;
+
+std::string dyntab_snapshot::dump() const {
+  std::string out;
+  out += "dynamic table: size " + std::to_string(current_size) + "/" + std::to_string(max_size) +
+         ", entries " + std::to_string(entries.size()) + ", inserted " + std::to_string(insert_count) + "\n";
+  for (const entry& e : entries) {
+    out += "[" + std::to_string(e.index) + "] size " + std::to_string(e.size) + ", insert #" +
+           std::to_string(e.insert_number) + ", hits " + std::to_string(e.hits) + ": ";
+    out += e.name;
+    out += ": ";
+    out += e.value;
+    out += '\n';
+  }
+  return out;
 }
 
 }  // namespace hpack
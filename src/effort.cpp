@@ -0,0 +1,27 @@
+
+#include "hpack/effort.hpp"
+
+namespace hpack {
+
+encode_effort effort_controller::report_load(unsigned load_percent) noexcept {
+  encode_effort cur = level.load(std::memory_order_relaxed);
+  for (;;) {
+    encode_effort next = cur;
+    if (load_percent > opts.high_load_percent && cur != encode_effort::static_only)
+      next = encode_effort(uint8_t(cur) - 1);
+    else if (load_percent < opts.low_load_percent && cur != encode_effort::max)
+      next = encode_effort(uint8_t(cur) + 1);
+    if (next == cur)
+      return cur;
+    // other thread may report load concurrently, one step per report
+    if (level.compare_exchange_weak(cur, next, std::memory_order_relaxed))
+      return next;
+  }
+}
+
+effort_controller& global_effort_controller() noexcept {
+  static effort_controller controller;
+  return controller;
+}
+
+}  // namespace hpack
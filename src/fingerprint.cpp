@@ -0,0 +1,61 @@
+
+#include "hpack/fingerprint.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hpack {
+
+namespace {
+
+constexpr uint64_t mul = 0x9E37'79B9'7F4A'7C15;
+
+// splitmix64 finalizer
+uint64_t mix(uint64_t x) noexcept {
+  x ^= x >> 30;
+  x *= 0xBF58'476D'1CE4'E5B9;
+  x ^= x >> 27;
+  x *= 0x94D0'49BB'1331'11EB;
+  x ^= x >> 31;
+  return x;
+}
+
+// word at a time, hashed bytes are just decoded and in cache
+uint64_t hash_bytes(std::string_view str, uint64_t h) noexcept {
+  const char* p = str.data();
+  size_t n = str.size();
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = (h ^ w) * mul;
+    h ^= h >> 32;
+  }
+  uint64_t tail = 0;
+  if (n)
+    std::memcpy(&tail, p, n);
+  return mix((h ^ tail ^ (uint64_t(str.size()) << 56)) * mul);
+}
+
+}  // namespace
+
+header_fingerprint::header_fingerprint(std::span<const std::string_view> selected, uint64_t seed)
+    : all(false), seed(seed) {
+  for (std::string_view name : selected) {
+    std::string& n = names.emplace_back(name);
+    std::transform(n.begin(), n.end(), n.begin(), [](char c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; });
+    lengths_mask |= uint64_t(1) << (n.size() % 64);
+  }
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+uint64_t header_fingerprint::hash(std::string_view name, std::string_view value) const noexcept {
+  return hash_bytes(value, hash_bytes(name, seed));
+}
+
+uint64_t header_fingerprint::finish(const fingerprint_state& state) const noexcept {
+  // sum is commutative, count separates empty list from list which sums to 0
+  return mix(state.sum ^ mix(seed + state.count));
+}
+
+}  // namespace hpack
@@ -1,8 +1,15 @@
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cassert>
 
-#include "hpack/basic_types.hpp"
+#include "hpack/huffman.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HPACK_HUFFMAN_AVX2
+#include <immintrin.h>
+#endif
 
 namespace hpack {
 
@@ -395,4 +402,455 @@ end:
   return uint16_t(-1);
 }
 
+namespace {
+
+// decodes huffman string by 4 bits,
+// states are internal nodes of huffman tree (root is 0).
+// Transition packed into one integer:
+//   bits [0, 12) - next state * 16 (so 'entry & state_mask | nibble' is index of next transition)
+//   bits [12, 16) - flags
+//   bits [16, 24) - decoded symbol
+enum : uint32_t {
+  fsm_state_mask = 0xFF0,
+  fsm_emit = 1 << 12,    // symbol decoded
+  fsm_accept = 1 << 13,  // next state may be end of string (padding of at most 7 ones)
+  fsm_eos = 1 << 14,     // EOS decoded, decoding error (RFC 7541 5.2)
+};
+
+using huffman_fsm_t = std::array<uint32_t, 256 * 16>;
+
+consteval huffman_fsm_t create_huffman_fsm() {
+  // >= 0 internal node, < 0 leaf with symbol -(child + 1), root is never a child
+  int16_t child[256][2] = {};
+  // depth if path from root contains only ones, 0xFF otherwise
+  uint8_t ones_depth[256] = {};
+  int nodes = 1;
+  for (int sym = 0; sym < 257; ++sym) {
+    sym_info_t info = huffman_table[sym];
+    int node = 0;
+    for (int i = 0; i < info.bit_count; ++i) {
+      int bit = (info.bits >> i) & 1;
+      if (i + 1 == info.bit_count) {
+        child[node][bit] = -(sym + 1);
+        break;
+      }
+      if (child[node][bit] == 0) {
+        child[node][bit] = nodes;
+        ones_depth[nodes] = bit && ones_depth[node] != 0xFF ? ones_depth[node] + 1 : 0xFF;
+        ++nodes;
+      }
+      node = child[node][bit];
+    }
+  }
+  // huffman code is complete, 257 leafs
+  if (nodes != 256)
+    throw 42;
+  huffman_fsm_t fsm{};
+  for (int state = 0; state < 256; ++state) {
+    for (int nibble = 0; nibble < 16; ++nibble) {
+      uint32_t e = 0;
+      int node = state;
+      // min symbol len is 5 bits, so at most one symbol per 4 bits
+      for (int i = 3; i >= 0; --i) {
+        int c = child[node][(nibble >> i) & 1];
+        if (c >= 0) {
+          node = c;
+          continue;
+        }
+        if (c == -257) {
+          e |= fsm_eos;
+          break;
+        }
+        e |= fsm_emit | (uint32_t(-c - 1) << 16);
+        node = 0;
+      }
+      e |= uint32_t(node) << 4;
+      if (ones_depth[node] <= 7)
+        e |= fsm_accept;
+      fsm[state * 16 + nibble] = e;
+    }
+  }
+  return fsm;
+}
+
+constexpr huffman_fsm_t huffman_fsm = create_huffman_fsm();
+
+// 'state' is state * 16, 'last' is last transition
+// protocol error if EOS decoded
+// Note: writes (but not emits) one byte after decoded string
+[[gnu::always_inline]] inline void huffman_decode_byte(byte_t byte, uint32_t& last, char*& out) {
+  // branchless emitting, because its unpredictable
+  uint32_t hi = huffman_fsm[(last & fsm_state_mask) | (byte >> 4)];
+  *out = char(hi >> 16);
+  out += (hi / fsm_emit) & 1;
+  uint32_t lo = huffman_fsm[(hi & fsm_state_mask) | (byte & 0xF)];
+  // one branch for both halves
+  if ((hi | lo) & fsm_eos) [[unlikely]]
+    handle_protocol_error();
+  *out = char(lo >> 16);
+  out += (lo / fsm_emit) & 1;
+  last = lo;
+}
+
+// decodes N strings in one loop while all of them have bytes, then tails one by one
+// Note: all state in locals, stores into 'out' may alias everything else
+template <size_t N>
+void huffman_decode_lanes(huffman_decode_job* jobs) {
+  In in[N];
+  char* out[N];
+  // initially root state and accepted (empty string)
+  uint32_t last[N];
+  size_type common = jobs[0].len;
+  for (size_t l = 0; l < N; ++l) {
+    in[l] = jobs[l].in;
+    out[l] = jobs[l].out;
+    last[l] = fsm_accept;
+    common = std::min(common, jobs[l].len);
+  }
+  for (size_type i = 0; i < common; ++i) {
+    for (size_t l = 0; l < N; ++l)
+      huffman_decode_byte(in[l][i], last[l], out[l]);
+  }
+  for (size_t l = 0; l < N; ++l) {
+    for (size_type i = common, len = jobs[l].len; i < len; ++i)
+      huffman_decode_byte(in[l][i], last[l], out[l]);
+    // padding must be at most 7 bits of EOS prefix (ones)
+    if (!(last[l] & fsm_accept))
+      handle_protocol_error();
+    jobs[l].decoded_len = out[l] - jobs[l].out;
+  }
+}
+
+// codes with first bit in most significant position, for word-at-a-time encoding
+struct msb_code_t {
+  uint32_t code;
+  uint32_t len;
+};
+
+consteval std::array<msb_code_t, 256> create_msb_codes() {
+  std::array<msb_code_t, 256> codes{};
+  for (int sym = 0; sym < 256; ++sym) {
+    sym_info_t info = huffman_table[sym];
+    uint32_t code = 0;
+    for (int i = 0; i < info.bit_count; ++i)
+      code = (code << 1) | ((info.bits >> i) & 1);
+    codes[sym] = {code, info.bit_count};
+  }
+  return codes;
+}
+
+constexpr std::array<msb_code_t, 256> msb_codes = create_msb_codes();
+
+[[gnu::always_inline]] inline void put_be32(uint32_t v, byte_t* out) noexcept {
+  out[0] = byte_t(v >> 24);
+  out[1] = byte_t(v >> 16);
+  out[2] = byte_t(v >> 8);
+  out[3] = byte_t(v);
+}
+
+byte_t* huffman_encode_scalar(std::string_view str, huffman_encoder_state& state, byte_t* out) noexcept {
+  // invariant: count < 32, so 'bits' never overflows (count + 30 < 64)
+  uint64_t bits = state.bits;
+  uint32_t count = state.count;
+  for (char c : str) {
+    msb_code_t code = msb_codes[uint8_t(c)];
+    bits = (bits << code.len) | code.code;
+    count += code.len;
+    if (count >= 32) {
+      count -= 32;
+      put_be32(uint32_t(bits >> count), out);
+      out += 4;
+    }
+  }
+  state.bits = bits & ((uint64_t(1) << count) - 1);
+  state.count = count;
+  return out;
+}
+
+#ifdef HPACK_HUFFMAN_AVX2
+
+// shorter strings are faster by scalar encoder
+constexpr size_t huffman_avx2_min_size = 96;
+
+#define HPACK_AVX2 gnu::target("avx2"), gnu::always_inline
+
+// msb_codes as 'code | len << 32', one load per char
+consteval std::array<uint64_t, 256> create_packed_codes() {
+  std::array<uint64_t, 256> codes{};
+  for (int sym = 0; sym < 256; ++sym)
+    codes[sym] = msb_codes[sym].code | uint64_t(msb_codes[sym].len) << 32;
+  return codes;
+}
+
+constexpr std::array<uint64_t, 256> packed_codes = create_packed_codes();
+
+// 64-bit lanes of 'x' moved one lane up, zero shifted in
+[[HPACK_AVX2]] inline __m256i lanes_up(__m256i x) noexcept {
+  return _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0b10'01'00'00), _mm256_setzero_si256(), 0b0000'0011);
+}
+
+// 'x' as 256-bit big endian number (lane 0 is most significant) shifted right by 'n' < 128 bits,
+// 'n' in each lane, lanes 2 and 3 of 'x' are zero
+[[HPACK_AVX2]] inline __m256i shift_right(__m256i x, __m256i n) noexcept {
+  const __m256i bits = _mm256_and_si256(n, _mm256_set1_epi64x(63));
+  x = _mm256_blendv_epi8(x, lanes_up(x), _mm256_cmpgt_epi64(n, _mm256_set1_epi64x(63)));
+  // shift by 64 gives 0
+  return _mm256_or_si256(_mm256_srlv_epi64(x, bits),
+                         _mm256_sllv_epi64(lanes_up(x), _mm256_sub_epi64(_mm256_set1_epi64x(64), bits)));
+}
+
+// encodes 8 chars 'sym' after 'count' < 8 bits of 'carry' (in most significant bits),
+// codes are merged by tree:
+// - codes of pairs of chars into 64-bit lanes (at most 60 bits),
+// - pairs into left aligned 128-bit halves by prefix sum of pair lengths in each half,
+// - second half shifted right by length of first one, then all by 'count'.
+// Stores 32 bytes into 'out', returns count of complete bytes, rest bits are new 'carry'
+[[HPACK_AVX2]] inline uint32_t huffman_encode_block(const uint8_t* sym, uint32_t& count, uint64_t& carry,
+                                                    byte_t* out) noexcept {
+  const uint64_t* codes = packed_codes.data();
+  const __m256i low_half = _mm256_set1_epi64x(0xFFFF'FFFF);
+  const __m256i bits64 = _mm256_set1_epi64x(64);
+  const __m256i bits128 = _mm256_set1_epi64x(128);
+  const __m256i bswap64 = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,  //
+                                           7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  // lane j is code of char 2j and 2j + 1,
+  // gathered by scalar loads, vpgatherdq was slower than them on tested Intel CPUs
+  __m256i first = _mm256_setr_epi64x(codes[sym[0]], codes[sym[2]], codes[sym[4]], codes[sym[6]]);
+  __m256i second = _mm256_setr_epi64x(codes[sym[1]], codes[sym[3]], codes[sym[5]], codes[sym[7]]);
+  __m256i second_len = _mm256_srli_epi64(second, 32);
+  __m256i pair = _mm256_or_si256(_mm256_sllv_epi64(_mm256_and_si256(first, low_half), second_len),
+                                 _mm256_and_si256(second, low_half));
+  __m256i pair_len = _mm256_add_epi64(_mm256_srli_epi64(first, 32), second_len);
+  // end of pair in its half, second lane of half is length of half (at most 120)
+  __m256i end = _mm256_add_epi64(pair_len, _mm256_bslli_epi128(pair_len, 8));
+  // part of pair in first and second word of half,
+  // shifts by 64 or more (and 'negative' ones) give 0, so no branches for pairs crossing words
+  __m256i head = _mm256_or_si256(_mm256_sllv_epi64(pair, _mm256_sub_epi64(bits64, end)),
+                                 _mm256_srlv_epi64(pair, _mm256_sub_epi64(end, bits64)));
+  __m256i tail = _mm256_sllv_epi64(pair, _mm256_sub_epi64(bits128, end));
+  head = _mm256_or_si256(head, _mm256_bsrli_epi128(head, 8));
+  __m256i halves = _mm256_blend_epi32(head, tail, 0b1100'1100);
+  // first half is at bit 0, second one after it
+  __m256i first_len = _mm256_permute4x64_epi64(end, 0b01'01'01'01);
+  __m256i words = _mm256_blend_epi32(halves, _mm256_setzero_si256(), 0b1111'0000);
+  __m256i second_half = _mm256_blend_epi32(_mm256_permute4x64_epi64(halves, 0b00'00'11'10),
+                                           _mm256_setzero_si256(), 0b1111'0000);
+  words = _mm256_or_si256(words, shift_right(second_half, first_len));
+  // after carried bits, block is at most 240 bits, nothing is shifted out
+  words = _mm256_or_si256(_mm256_srl_epi64(words, _mm_cvtsi32_si128(count)),
+                          _mm256_sll_epi64(lanes_up(words), _mm_cvtsi32_si128(64 - count)));
+  words = _mm256_or_si256(words, _mm256_setr_epi64x(carry, 0, 0, 0));
+  _mm256_storeu_si256((__m256i*)out, _mm256_shuffle_epi8(words, bswap64));
+  const uint32_t total = count + uint32_t(_mm256_extract_epi64(_mm256_add_epi64(end, first_len), 3));
+  const uint32_t complete = total / 8;
+  carry = uint64_t(out[complete]) << 56;
+  count = total % 8;
+  return complete;
+}
+
+// blocks are independent except of shift by at most 7 carried bits
+[[gnu::target("avx2")]] byte_t* huffman_encode_avx2(std::string_view str, huffman_encoder_state& state,
+                                                    byte_t* out) noexcept {
+  uint32_t count = state.count;
+  for (; count >= 8; count -= 8)
+    *out++ = byte_t(state.bits >> (count - 8));
+  uint64_t carry = count ? state.bits << (64 - count) : 0;
+  const uint8_t* sym = (const uint8_t*)str.data();
+  size_t i = 0;
+  // at least 52 chars (5 bits each) after block, so whole store is inside of encoded string
+  for (; i + 8 + 52 <= str.size(); i += 8)
+    out += huffman_encode_block(sym + i, count, carry, out);
+  // at most 7 last blocks through buffer
+  byte_t buf[7 * 30 + 32];
+  byte_t* e = buf;
+  for (; i + 8 <= str.size(); i += 8)
+    e += huffman_encode_block(sym + i, count, carry, e);
+  out = std::copy(buf, e, out);
+  state.bits = count ? carry >> (64 - count) : 0;
+  state.count = count;
+  str.remove_prefix(i);
+  return huffman_encode_scalar(str, state, out);
+}
+
+#undef HPACK_AVX2
+
+bool cpu_has_avx2() noexcept {
+  static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+  return has;
+}
+
+#endif
+
+}  // namespace
+
+namespace noexport {
+
+bool huffman_encode_path_supported(huffman_encode_path path) noexcept {
+  switch (path) {
+    case huffman_encode_path::scalar:
+      return true;
+    case huffman_encode_path::avx2:
+#ifdef HPACK_HUFFMAN_AVX2
+      return cpu_has_avx2();
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+byte_t* huffman_encode_chunk(std::string_view str, huffman_encoder_state& state, byte_t* out,
+                             huffman_encode_path path) noexcept {
+  assert(huffman_encode_path_supported(path));
+#ifdef HPACK_HUFFMAN_AVX2
+  if (path == huffman_encode_path::avx2)
+    return huffman_encode_avx2(str, state, out);
+#endif
+  return huffman_encode_scalar(str, state, out);
+}
+
+}  // namespace noexport
+
+byte_t* huffman_encode_chunk(std::string_view str, huffman_encoder_state& state, byte_t* out) noexcept {
+#ifdef HPACK_HUFFMAN_AVX2
+  if (str.size() >= huffman_avx2_min_size && cpu_has_avx2())
+    return huffman_encode_avx2(str, state, out);
+#endif
+  return huffman_encode_scalar(str, state, out);
+}
+
+byte_t* huffman_encode_finish(huffman_encoder_state& state, byte_t* out) noexcept {
+  uint32_t padding = (8 - state.count % 8) % 8;
+  uint64_t bits = (state.bits << padding) | ((uint64_t(1) << padding) - 1);
+  for (uint32_t count = state.count + padding; count; count -= 8)
+    *out++ = byte_t(bits >> (count - 8));
+  state = {};
+  return out;
+}
+
+size_type huffman_decode(In in, size_type len, char* out) {
+  huffman_decode_job job{.in = in, .len = len, .out = out};
+  huffman_decode_lanes<1>(&job);
+  return job.decoded_len;
+}
+
+bool huffman_decode_number(In in, size_type len, uint64_t& value, size_type* digits_count) {
+  uint64_t v = 0;
+  size_type digits = 0;
+  uint32_t last = fsm_accept;
+  for (size_type i = 0; i < len; ++i) {
+    for (int shift : {4, 0}) {
+      last = huffman_fsm[(last & fsm_state_mask) | ((in[i] >> shift) & 0xF)];
+      if (last & fsm_eos) [[unlikely]]
+        handle_protocol_error();
+      if (last & fsm_emit) {
+        uint8_t d = uint8_t(last >> 16) - '0';
+        if (d > 9 || v > (UINT64_MAX - d) / 10)
+          return false;
+        v = v * 10 + d;
+        ++digits;
+      }
+    }
+  }
+  if (!(last & fsm_accept))
+    handle_protocol_error();
+  value = v;
+  if (digits_count)
+    *digits_count = digits;
+  return digits != 0;
+}
+
+static size_t huffman_encoded_bits(std::string_view str) noexcept {
+  // independent sums, loop is not bound by latency of one adder
+  size_t bits[4] = {};
+  size_t i = 0;
+  for (; i + 4 <= str.size(); i += 4) {
+    for (size_t j = 0; j < 4; ++j)
+      bits[j] += msb_codes[uint8_t(str[i + j])].len;
+  }
+  for (; i < str.size(); ++i)
+    bits[0] += msb_codes[uint8_t(str[i])].len;
+  return bits[0] + bits[1] + bits[2] + bits[3];
+}
+
+size_t huffman_encoded_size(std::string_view str) noexcept {
+  return (huffman_encoded_bits(str) + 7) / 8;
+}
+
+size_t huffman_encoded_size(std::span<const std::string_view> chunks) noexcept {
+  size_t bits = 0;
+  for (std::string_view chunk : chunks)
+    bits += huffman_encoded_bits(chunk);
+  return (bits + 7) / 8;
+}
+
+size_t huffman_decoded_size(std::span<const byte_t> huffman_str) {
+  size_t count = 0;
+  uint32_t last = fsm_accept;
+  for (byte_t byte : huffman_str) {
+    for (int shift : {4, 0}) {
+      last = huffman_fsm[(last & fsm_state_mask) | ((byte >> shift) & 0xF)];
+      if (last & fsm_eos) [[unlikely]]
+        handle_protocol_error();
+      count += (last / fsm_emit) & 1;
+    }
+  }
+  if (!(last & fsm_accept))
+    handle_protocol_error();
+  return count;
+}
+
+std::span<byte_t> huffman_encode(std::string_view str, std::span<byte_t> out) noexcept {
+  assert(out.size() >= huffman_encoded_size(str));
+  // chunk writes only complete bytes (whole stores of avx2 path are checked to be inside of encoded string)
+  // and finish only rest bytes, so nothing is written after encoded string
+  huffman_encoder_state state;
+  byte_t* e = huffman_encode_chunk(str, state, out.data());
+  e = huffman_encode_finish(state, e);
+  return out.first(e - out.data());
+}
+
+std::span<char> huffman_decode(std::span<const byte_t> huffman_str, std::span<char> out) {
+  if (out.size() >= max_huffman_string_size_after_decode(huffman_str.size()))
+    return out.first(huffman_decode(huffman_str.data(), huffman_str.size(), out.data()));
+  char* o = out.data();
+  char* const oe = o + out.size();
+  uint32_t last = fsm_accept;
+  size_t i = 0;
+  // one byte emits at most 2 chars, writes only into them
+  for (; i < huffman_str.size() && oe - o >= 2; ++i)
+    huffman_decode_byte(huffman_str[i], last, o);
+  // tail, emits with bound checks
+  for (; i < huffman_str.size(); ++i) {
+    for (int shift : {4, 0}) {
+      last = huffman_fsm[(last & fsm_state_mask) | ((huffman_str[i] >> shift) & 0xF)];
+      if (last & fsm_eos) [[unlikely]]
+        handle_protocol_error();
+      if (last & fsm_emit) {
+        if (o == oe)
+          handle_size_error();
+        *o++ = char(last >> 16);
+      }
+    }
+  }
+  if (!(last & fsm_accept))
+    handle_protocol_error();
+  return out.first(o - out.data());
+}
+
+void huffman_decode_interleaved(std::span<huffman_decode_job> jobs) {
+  auto* it = jobs.data();
+  auto* e = it + jobs.size();
+  for (; e - it >= 4; it += 4)
+    huffman_decode_lanes<4>(it);
+  switch (e - it) {
+    case 3:
+      return huffman_decode_lanes<3>(it);
+    case 2:
+      return huffman_decode_lanes<2>(it);
+    case 1:
+      return huffman_decode_lanes<1>(it);
+  }
+}
+
 }  // namespace hpack
@@ -0,0 +1,130 @@
+
+#include "hpack/learned_policy.hpp"
+
+#include <algorithm>
+
+namespace hpack {
+
+header_decision learned_policy::decide(const learned_name_stats& stats) const noexcept {
+  if (stats.seen < opts.min_samples)
+    return {opts.index, opts.huffman};
+  const uint64_t max_huffman_percent = 100 - std::min(opts.min_huffman_saving_percent, 100u);
+  return {
+      .index = uint64_t(stats.repeats) * 100 >= uint64_t(opts.min_repeat_percent) * stats.seen,
+      .huffman = stats.huffman_bytes * 100 < stats.raw_bytes * max_huffman_percent,
+  };
+}
+
+header_decision learned_policy::observe(std::string_view name, std::string_view value) {
+  auto it = names.find(name);
+  if (it == names.end()) {
+    if (names.size() >= opts.max_names)
+      return {opts.index, opts.huffman};
+    it = names.emplace(name, name_state{}).first;
+  }
+  name_state& s = it->second;
+  learned_name_stats& stats = s.stats;
+  // decision by previous values, current one is encoded anyway
+  header_decision d = decide(stats);
+  const uint64_t h = std::hash<std::string_view>{}(value);
+  if (std::find(std::begin(s.recent), std::end(s.recent), h) != std::end(s.recent))
+    ++stats.repeats;
+  else
+    s.recent[s.next_recent++ % std::size(s.recent)] = h;
+  if (stats.seen < opts.min_samples || stats.seen % std::max(opts.huffman_sample_period, 1u) == 0) {
+    ++stats.huffman_samples;
+    stats.raw_bytes += value.size();
+    stats.huffman_bytes += huffman_encoded_size(value);
+  }
+  ++stats.seen;
+  if (stats.seen >= opts.decay_after) {
+    stats.seen /= 2;
+    stats.repeats /= 2;
+    stats.huffman_samples /= 2;
+    stats.raw_bytes /= 2;
+    stats.huffman_bytes /= 2;
+  }
+  return d;
+}
+
+header_decision learned_policy::decision_for(std::string_view name) const noexcept {
+  const learned_name_stats* stats = stats_of(name);
+  return stats ? decide(*stats) : header_decision{opts.index, opts.huffman};
+}
+
+const learned_name_stats* learned_policy::stats_of(std::string_view name) const noexcept {
+  auto it = names.find(name);
+  return it == names.end() ? nullptr : &it->second.stats;
+}
+
+learned_policy_snapshot learned_policy::export_stats() const {
+  learned_policy_snapshot snapshot;
+  snapshot.names.reserve(names.size());
+  for (auto& [name, s] : names)
+    snapshot.names.emplace_back(name, s.stats);
+  std::sort(snapshot.names.begin(), snapshot.names.end(),
+            [](auto& a, auto& b) { return a.second.seen > b.second.seen; });
+  return snapshot;
+}
+
+void learned_policy::import_stats(const learned_policy_snapshot& snapshot) {
+  for (auto& [name, stats] : snapshot.names) {
+    auto it = names.find(name);
+    if (it == names.end()) {
+      if (names.size() >= opts.max_names)
+        continue;
+      it = names.emplace(name, name_state{}).first;
+    }
+    it->second.stats = stats;
+  }
+}
+
+void learned_policy_cache::store(std::string_view peer, learned_policy_snapshot snapshot) {
+  if (max_peers == 0)
+    return;
+  auto ptr = std::make_shared<const learned_policy_snapshot>(std::move(snapshot));
+  std::lock_guard lock(mtx);
+  if (auto it = peers.find(peer); it != peers.end()) {
+    it->second->second = std::move(ptr);
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+  if (lru.size() >= max_peers) {
+    peers.erase(lru.back().first);
+    lru.pop_back();
+  }
+  lru.emplace_front(std::string(peer), std::move(ptr));
+  peers.emplace(lru.front().first, lru.begin());
+}
+
+bool learned_policy_cache::load(std::string_view peer, learned_policy& policy) {
+  snapshot_ptr snapshot;
+  {
+    std::lock_guard lock(mtx);
+    auto it = peers.find(peer);
+    if (it == peers.end())
+      return false;
+    lru.splice(lru.begin(), lru, it->second);
+    snapshot = it->second->second;
+  }
+  // snapshot is immutable, imported without lock
+  policy.import_stats(*snapshot);
+  return true;
+}
+
+void learned_policy_cache::erase(std::string_view peer) {
+  std::lock_guard lock(mtx);
+  auto it = peers.find(peer);
+  if (it == peers.end())
+    return;
+  lru_t::iterator node = it->second;
+  peers.erase(it);
+  lru.erase(node);
+}
+
+size_t learned_policy_cache::size() const {
+  std::lock_guard lock(mtx);
+  return lru.size();
+}
+
+}  // namespace hpack
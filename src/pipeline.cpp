@@ -0,0 +1,127 @@
+
+#include "hpack/pipeline.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace hpack {
+
+namespace {
+
+// decodes huffman strings of 'h' into 'scratch', 'h' points into it after
+void decode_now(header_representation& h, std::vector<char>& scratch) {
+  const size_t name_max = h.name_huffman ? max_huffman_string_size_after_decode(h.name.size()) : 0;
+  const size_t value_max = h.value_huffman ? max_huffman_string_size_after_decode(h.value.size()) : 0;
+  if (scratch.size() < name_max + value_max)
+    scratch.resize(name_max + value_max);
+  if (h.name_huffman) {
+    size_type len = huffman_decode((In)h.name.data(), h.name.size(), scratch.data());
+    h.name = {scratch.data(), len};
+    h.name_huffman = false;
+  }
+  if (h.value_huffman) {
+    size_type len = huffman_decode((In)h.value.data(), h.value.size(), scratch.data() + name_max);
+    h.value = {scratch.data() + name_max, len};
+    h.value_huffman = false;
+  }
+}
+
+}  // namespace
+
+decode_pipeline::lazy_string decode_pipeline::append(slot_t& slot, std::string_view str, bool huffman) {
+  const size_t offset = slot.arena.size();
+  slot.arena.insert(slot.arena.end(), (const byte_t*)str.data(), (const byte_t*)str.data() + str.size());
+  return {uint32_t(offset), uint32_t(str.size()), huffman};
+}
+
+decode_pipeline::decode_pipeline(size_t capacity)
+    : slots(std::make_unique<slot_t[]>(std::bit_ceil(std::max<size_t>(capacity, 1)))),
+      mask(std::bit_ceil(std::max<size_t>(capacity, 1)) - 1) {
+}
+
+bool decode_pipeline::try_push(decoder& dec, uint32_t stream_id, std::span<const byte_t> bytes) {
+  const size_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) > mask)
+    return false;
+  slot_t& slot = slots[h & mask];
+  slot.stream_id = stream_id;
+  slot.arena.clear();
+  slot.headers.clear();
+  In in = bytes.data();
+  In e = in + bytes.size();
+  header_representation r;
+  using enum header_representation::kind_e;
+  while (in != e) {
+    scan_header(in, e, r);
+    switch (r.kind) {
+      case size_update:
+        (void)dec.apply(r, producer_buffers);
+        continue;
+      case with_indexing:
+        decode_now(r, producer_scratch);
+        [[fallthrough]];
+      case fully_indexed: {
+        // copied, entry may be evicted before consumer reads it
+        table_entry entry = dec.apply(r, producer_buffers);
+        lazy_string name = append(slot, entry.name, false);
+        slot.headers.push_back({name, append(slot, entry.value, false)});
+        continue;
+      }
+      case without_indexing:
+      case never_indexed: {
+        // literals not inserted into table are decoded by consumer
+        lazy_string name = r.index == 0 ? append(slot, r.name, r.name_huffman)
+                                        : append(slot, get_by_index(r.index, &dec.dyntab).name, false);
+        slot.headers.push_back({name, append(slot, r.value, r.value_huffman)});
+        continue;
+      }
+    }
+  }
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+void decode_pipeline::finish_slot(slot_t& slot) {
+  jobs.clear();
+  entries.clear();
+  size_t decoded_size = 0;
+  for (const lazy_header& h : slot.headers) {
+    if (h.name.huffman)
+      decoded_size += max_huffman_string_size_after_decode(h.name.len);
+    if (h.value.huffman)
+      decoded_size += max_huffman_string_size_after_decode(h.value.len);
+  }
+  if (decoded.size() < decoded_size)
+    decoded.resize(decoded_size);
+  char* out = decoded.data();
+  auto add_job = [&](const lazy_string& str) {
+    if (!str.huffman)
+      return;
+    jobs.push_back({.in = slot.arena.data() + str.offset, .len = str.len, .out = out});
+    out += max_huffman_string_size_after_decode(str.len);
+  };
+  for (const lazy_header& h : slot.headers) {
+    add_job(h.name);
+    add_job(h.value);
+  }
+  huffman_decode_interleaved(jobs);
+  // same order as jobs added
+  auto job = jobs.begin();
+  auto str = [&](const lazy_string& s) {
+    if (!s.huffman)
+      return std::string_view((const char*)slot.arena.data() + s.offset, s.len);
+    std::string_view decoded_str(job->out, job->decoded_len);
+    ++job;
+    return decoded_str;
+  };
+  for (const lazy_header& h : slot.headers) {
+    table_entry& entry = entries.emplace_back();
+    entry.name = str(h.name);
+    entry.value = str(h.value);
+    // RFC 9113 8.2.1: uppercase name is malformed
+    if (std::any_of(entry.name.begin(), entry.name.end(), [](char c) { return c >= 'A' && c <= 'Z'; }))
+      handle_protocol_error();
+  }
+}
+
+}  // namespace hpack
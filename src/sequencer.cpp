@@ -0,0 +1,39 @@
+
+#include "hpack/sequencer.hpp"
+
+namespace hpack {
+
+encode_sequencer::~encode_sequencer() {
+  destroy(head.exchange(nullptr, std::memory_order_acquire));
+}
+
+void encode_sequencer::submit(uint32_t stream_id, header_list headers) {
+  node_t* n = new node_t{nullptr, stream_id, std::move(headers)};
+  node_t* old = head.load(std::memory_order_relaxed);
+  do {
+    n->next = old;
+  } while (!head.compare_exchange_weak(old, n, std::memory_order_release, std::memory_order_relaxed));
+}
+
+encode_sequencer::node_t* encode_sequencer::take_all() noexcept {
+  // stack is in reverse order of submission
+  node_t* n = head.exchange(nullptr, std::memory_order_acquire);
+  node_t* reversed = nullptr;
+  while (n) {
+    node_t* next = n->next;
+    n->next = reversed;
+    reversed = n;
+    n = next;
+  }
+  return reversed;
+}
+
+void encode_sequencer::destroy(node_t* list) noexcept {
+  while (list) {
+    node_t* next = list->next;
+    delete list;
+    list = next;
+  }
+}
+
+}  // namespace hpack
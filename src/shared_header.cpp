@@ -0,0 +1,123 @@
+
+#include "hpack/shared_header.hpp"
+#include "hpack/strings.hpp"
+
+#include <chrono>
+#include <cstring>
+
+namespace hpack {
+
+bool shared_encoded_header::publish(uint64_t tick, std::string_view value) {
+  // encode before locking, readers wait only for copying
+  byte_t buf[max_encoded_size + sizeof(uint64_t)] = {};
+  // name index (4+), value len (7+), value
+  if (huffman_encoded_size(value) + 2 * 4 > max_encoded_size)
+    return false;
+  byte_t* out = buf;
+  *out = 0;
+  out = encode_integer(name_index, 4, out);
+  out = encode_string<true>(value, out);
+  const size_t sz = out - buf;
+
+  uint64_t s = seq.load(std::memory_order_relaxed);
+  if ((s & 1) || !seq.compare_exchange_strong(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+    return false;
+  if (tick <= _tick.load(std::memory_order_relaxed)) {
+    // nothing written
+    seq.store(s, std::memory_order_release);
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  size.store(sz, std::memory_order_relaxed);
+  for (size_t i = 0; i < (sz + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++i) {
+    uint64_t w;
+    std::memcpy(&w, buf + i * sizeof(uint64_t), sizeof(uint64_t));
+    words[i].store(w, std::memory_order_relaxed);
+  }
+  _tick.store(tick, std::memory_order_relaxed);
+  seq.store(s + 2, std::memory_order_release);
+  return true;
+}
+
+size_t shared_encoded_header::load(byte_t* out) const noexcept {
+  for (;;) {
+    uint64_t s1 = seq.load(std::memory_order_acquire);
+    if (s1 & 1)
+      continue;
+    size_t sz = size.load(std::memory_order_relaxed);
+    uint64_t buf[words_count];
+    const size_t n = (sz + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    for (size_t i = 0; i < n; ++i)
+      buf[i] = words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq.load(std::memory_order_relaxed) != s1)
+      continue;
+    std::memcpy(out, buf, sz);
+    return sz;
+  }
+}
+
+shared_encoded_header& shared_date_header() noexcept {
+  static shared_encoded_header header(static_table_t::date);
+  return header;
+}
+
+void refresh_shared_date_header() {
+  using namespace std::chrono;
+  shared_encoded_header& h = shared_date_header();
+  const int64_t now = duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+  if (h.tick() >= uint64_t(now))
+    return;
+  char buf[29];
+  // if other thread publishes now, its value is used
+  (void)h.publish(now, std::string_view(buf, format_http_date(now, buf)));
+}
+
+size_t format_http_date(int64_t seconds_since_epoch, char* out) noexcept {
+  constexpr std::string_view weekdays[] = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+  constexpr std::string_view months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  int64_t days = seconds_since_epoch / 86400;
+  int64_t secs = seconds_since_epoch % 86400;
+  if (secs < 0) {
+    secs += 86400;
+    --days;
+  }
+  // 1970-01-01 is thursday
+  const int64_t weekday = ((days % 7) + 7) % 7;
+  // civil from days, http://howardhinnant.github.io/date_algorithms.html
+  const int64_t z = days + 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const int64_t doe = z - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  const int64_t day = doy - (153 * mp + 2) / 5 + 1;
+  const int64_t month = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t year = yoe + era * 400 + (month <= 2);
+
+  auto put = [&](std::string_view s) { out = std::copy_n(s.data(), s.size(), out); };
+  auto put2 = [&](int64_t v) {
+    *out++ = '0' + v / 10;
+    *out++ = '0' + v % 10;
+  };
+  char* b = out;
+  put(weekdays[weekday]);
+  put(", ");
+  put2(day);
+  *out++ = ' ';
+  put(months[month - 1]);
+  *out++ = ' ';
+  put2(year / 100 % 100);
+  put2(year % 100);
+  *out++ = ' ';
+  put2(secs / 3600);
+  *out++ = ':';
+  put2(secs / 60 % 60);
+  *out++ = ':';
+  put2(secs % 60);
+  put(" GMT");
+  return out - b;
+}
+
+}  // namespace hpack
@@ -2,6 +2,7 @@
 #include "hpack/static_table.hpp"
 
 #include <cassert>
+#include <iterator>
 
 namespace hpack {
 
@@ -86,18 +87,19 @@ index_type static_table_t::find_by_value(std::string_view value) noexcept {
   return r;
 }
 
+const table_entry static_table_t::entries[] = {
+    {"", ""},
+#define STATIC_TABLE_ENTRY(cppname, name, ...) {name __VA_OPT__(, __VA_ARGS__)},
+#include "hpack/static_table.def"
+};
+
+static_assert(std::size(static_table_t::entries) == static_table_t::first_unused_index);
+
 // precondition: index < first_unused_index && index != 0
 // .value empty if no cached
 table_entry static_table_t::get_entry(index_type index) {
   assert(index < first_unused_index && index != 0);
-  switch (index) {
-#define STATIC_TABLE_ENTRY(cppname, name, ...) \
-  case values::cppname:                        \
-    return {name __VA_OPT__(, __VA_ARGS__)};
-#include "hpack/static_table.def"
-    default:
-      return {"", ""};
-  }
+  return entries[index];
 }
 
 }  // namespace hpack
@@ -0,0 +1,160 @@
+#pragma once
+
+/*
+  allocation accounting for tests and benchmarks
+
+  counts:
+    * every malloc/calloc/realloc/aligned_alloc of the process (glibc only, by symbol interposition),
+      which also covers operator new and decoded_string huffman buffers
+    * allocations through std::pmr::memory_resource via 'counting_resource'
+      (dynamic table entries)
+
+  Note: defines 'malloc', so must be included in exactly one translation unit of executable.
+  Define HPACK_TEST_NO_MALLOC_INTERPOSE before include to use only 'counting_resource'
+  (no interposition and its atomic counters on every malloc)
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <memory_resource>
+
+// sanitizers replace malloc themselves
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__) && \
+    !defined(HPACK_TEST_NO_MALLOC_INTERPOSE)
+#define HPACK_TEST_INTERPOSE_MALLOC
+#endif
+
+namespace hpack_test {
+
+struct allocation_stats {
+  size_t count = 0;
+  size_t bytes = 0;
+
+  allocation_stats operator-(const allocation_stats& other) const noexcept {
+    return {count - other.count, bytes - other.bytes};
+  }
+};
+
+namespace noexport {
+
+inline std::atomic<size_t> malloc_count = 0;
+inline std::atomic<size_t> malloc_bytes = 0;
+
+inline void count_malloc(size_t sz) noexcept {
+  malloc_count.fetch_add(1, std::memory_order_relaxed);
+  malloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+}
+
+}  // namespace noexport
+
+// true if malloc interposition works on this platform,
+// otherwise malloc stats are always zero
+constexpr bool malloc_counting_supported() noexcept {
+#ifdef HPACK_TEST_INTERPOSE_MALLOC
+  return true;
+#else
+  return false;
+#endif
+}
+
+[[nodiscard]] inline allocation_stats malloc_stats() noexcept {
+  return {noexport::malloc_count.load(std::memory_order_relaxed),
+          noexport::malloc_bytes.load(std::memory_order_relaxed)};
+}
+
+// measures process-wide mallocs since construction
+struct malloc_scope {
+  allocation_stats before = malloc_stats();
+
+  [[nodiscard]] allocation_stats get() const noexcept {
+    return malloc_stats() - before;
+  }
+};
+
+// counts allocations and tracks bytes in use, forwards to 'upstream'
+struct counting_resource : std::pmr::memory_resource {
+  std::pmr::memory_resource* upstream;
+  allocation_stats allocated;
+  size_t deallocations = 0;
+  size_t bytes_in_use = 0;
+  size_t peak_bytes_in_use = 0;
+
+  explicit counting_resource(std::pmr::memory_resource* up = std::pmr::new_delete_resource()) noexcept
+      : upstream(up) {
+  }
+
+  void reset_stats() noexcept {
+    allocated = {};
+    deallocations = 0;
+    peak_bytes_in_use = bytes_in_use;
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t align) override {
+    void* p = upstream->allocate(bytes, align);
+    ++allocated.count;
+    allocated.bytes += bytes;
+    bytes_in_use += bytes;
+    if (bytes_in_use > peak_bytes_in_use)
+      peak_bytes_in_use = bytes_in_use;
+    return p;
+  }
+  void do_deallocate(void* p, size_t bytes, size_t align) override {
+    ++deallocations;
+    bytes_in_use -= bytes;
+    upstream->deallocate(p, bytes, align);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace hpack_test
+
+#ifdef HPACK_TEST_INTERPOSE_MALLOC
+
+extern "C" {
+
+void* __libc_malloc(size_t) noexcept;
+void* __libc_calloc(size_t, size_t) noexcept;
+void* __libc_realloc(void*, size_t) noexcept;
+void* __libc_memalign(size_t, size_t) noexcept;
+
+void* malloc(size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(sz);
+  return __libc_malloc(sz);
+}
+
+void* calloc(size_t n, size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(n * sz);
+  return __libc_calloc(n, sz);
+}
+
+void* realloc(void* p, size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(sz);
+  return __libc_realloc(p, sz);
+}
+
+// aligned operator new and aligned pmr allocations end up in aligned_alloc / memalign
+
+void* aligned_alloc(size_t align, size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(sz);
+  return __libc_memalign(align, sz);
+}
+
+void* memalign(size_t align, size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(sz);
+  return __libc_memalign(align, sz);
+}
+
+int posix_memalign(void** p, size_t align, size_t sz) noexcept {
+  hpack_test::noexport::count_malloc(sz);
+  *p = __libc_memalign(align, sz);
+  return *p ? 0 : ENOMEM;
+}
+
+}  // extern "C"
+
+#endif
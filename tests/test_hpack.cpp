@@ -1,8 +1,18 @@
 #include "hpack/hpack.hpp"
+#include "hpack/archive.hpp"
+#include "hpack/connection.hpp"
+#include "hpack/effort.hpp"
+#include "hpack/learned_policy.hpp"
+#include "hpack/pipeline.hpp"
+#include "hpack/sequencer.hpp"
+#include "hpack/shared_header.hpp"
+#include "allocation_counter.hpp"
 
 #include <random>
 #include <deque>
 #include <bit>
+#include <stdexcept>
+#include <thread>
 
 #define TEST(name) static void test_##name()
 #define error_if(...)    \
@@ -340,15 +350,17 @@ TEST(huffman_table_itself) {
 }
 
 TEST(huffman_encode_eos) {
-  // encoded string ("!") and EOS
+  // encoded string ("!") and EOS, EOS in string is decoding error (RFC 7541 5.2)
   bytes_t bytes{
       0x85, 0xfe, 0x3f, 0xff, 0xff, 0xff,
   };
   const uint8_t* in = bytes.data();
   hpack::decoded_string decoded;
-  hpack::decode_string(in, in + bytes.size(), decoded);
-  error_if(in != bytes.data() + bytes.size());
-  error_if(decoded.str() != "!");
+  try {
+    hpack::decode_string(in, in + bytes.size(), decoded);
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
 }
 
 TEST(static_table_find) {
@@ -521,6 +533,31 @@ TEST(decode_status) {
   error_if(555 != de.decode_response_status(in, rsp.data() + rsp.size()));
   error_if(in != rsp.data() + rsp.size());
   rsp.clear();
+
+  // zero padded status is not 3 digits, raw / huffman / cached
+  auto encoders = {
+      +[](hpack::encoder& e, std::string_view v, bytes_t& out) {
+        e.encode_header_without_indexing(hpack::static_table_t::status_200, v, std::back_inserter(out));
+      },
+      +[](hpack::encoder& e, std::string_view v, bytes_t& out) {
+        e.encode_header_without_indexing<true>(hpack::static_table_t::status_200, v, std::back_inserter(out));
+      },
+      +[](hpack::encoder& e, std::string_view v, bytes_t& out) {
+        e.encode_header_and_cache(hpack::static_table_t::status_200, v, std::back_inserter(out));
+      },
+  };
+  for (auto encode : encoders) {
+    for (std::string_view padded : {"0200", "00302", "099"}) {
+      encode(e, padded, rsp);
+      in = rsp.data();
+      try {
+        de.decode_response_status(in, rsp.data() + rsp.size());
+        error_if(true);
+      } catch (hpack::protocol_error&) {
+      }
+      rsp.clear();
+    }
+  }
 }
 
 TEST(dynamic_table_size_update) {
@@ -674,6 +711,1335 @@ TEST(decoded_string) {
   error_if(str != str);
 }
 
+TEST(allocation_budgets) {
+  if constexpr (!hpack_test::malloc_counting_supported())
+    return;
+  hpack_test::counting_resource resource;
+  hpack::encoder enc(4096, &resource);
+  hpack::decoder dec(4096, &resource);
+  auto ignore = [](std::string_view, std::string_view) {};
+  headers_t request{
+      {":method", "GET"},
+      {":scheme", "https"},
+      {":path", "/"},
+      {":authority", "www.example.com"},
+      {"user-agent", "Mozilla/5.0 (X11; Linux x86_64)"},
+      {"accept-encoding", "gzip, deflate"},
+  };
+  bytes_t block(512);
+  auto encode_block = [&] {
+    hpack_test::malloc_scope mallocs;
+    auto* e = hpack::encode_headers_block<true, true>(enc, request, block.data());
+    return std::pair(mallocs.get().count, size_t(e - block.data()));
+  };
+  // fully indexed block, static table only
+  {
+    bytes_t indexed{0x82, 0x87, 0x84, 0x90};
+    hpack_test::malloc_scope mallocs;
+    hpack::decode_headers_block(dec, indexed, ignore);
+    error_if(mallocs.get().count != 0);
+    error_if(resource.allocated.count != 0);
+  }
+  // first block, 'authority' and 'user-agent' inserted into dynamic table,
+  // one allocation per entry + growth of entries vector (capacity 1, 2)
+  auto [first_mallocs, first_size] = encode_block();
+  error_if(resource.allocated.count != 4);
+  error_if(first_mallocs > 4);
+  {
+    resource.reset_stats();
+    hpack_test::malloc_scope mallocs;
+    hpack::decode_headers_block(dec, std::span(block.data(), first_size), ignore);
+    error_if(resource.allocated.count != 4);
+    // entries + entries vector growth + huffman buffers of header_view
+    error_if(mallocs.get().count > 6);
+  }
+  // repeated block is fully indexed
+  {
+    resource.reset_stats();
+    auto [second_mallocs, second_size] = encode_block();
+    error_if(second_mallocs != 0);
+    error_if(second_size != request.size());
+    hpack_test::malloc_scope mallocs;
+    hpack::decode_headers_block(dec, std::span(block.data(), second_size), ignore);
+    error_if(mallocs.get().count != 0);
+    error_if(resource.allocated.count != 0);
+  }
+  // huffman literals without indexing reuse buffers of header_view
+  {
+    bytes_t bytes;
+    enc.encode_header_without_indexing<true>("x-request-id", "9f86d081884c7d659a2feaa0c55ad015",
+                                             std::back_inserter(bytes));
+    hpack::header_view header;
+    const auto* in = bytes.data();
+    dec.decode_header(in, in + bytes.size(), header);
+    hpack_test::malloc_scope mallocs;
+    for (int i = 0; i < 10; ++i) {
+      in = bytes.data();
+      dec.decode_header(in, in + bytes.size(), header);
+    }
+    error_if(mallocs.get().count != 0);
+    error_if(header.value.str() != "9f86d081884c7d659a2feaa0c55ad015");
+  }
+}
+
+TEST(huffman_padding) {
+  // padding longer than 7 bits
+  bytes_t bad{0x82, 0x1f, 0xff};  // "a" (00011) and 11 ones
+  const auto* in = bad.data();
+  hpack::decoded_string out;
+  try {
+    hpack::decode_string(in, in + bad.size(), out);
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+  // padding not from ones
+  bytes_t bad2{0x81, 0x18};  // "a" and 000
+  in = bad2.data();
+  try {
+    hpack::decode_string(in, in + bad2.size(), out);
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+  // one byte literal, decoded string reuses and regrows its buffer
+  for (std::string_view str : {"a", "", "abcdefghijklmnopqrstuvwxyz", "b"}) {
+    bytes_t bytes;
+    hpack::encode_string_huffman(str, std::back_inserter(bytes));
+    in = bytes.data();
+    hpack::decode_string(in, in + bytes.size(), out);
+    error_if(out.str() != str);
+  }
+  // code is byte aligned (8 symbols of 5 bits), no padding byte
+  bytes_t aligned;
+  hpack::encode_string_huffman("00000000", std::back_inserter(aligned));
+  error_if(aligned.size() != 1 + 5);
+}
+
+TEST(dynamic_table_add_evicted_name) {
+  hpack_test::counting_resource resource;
+  {
+    // name of new entry points into entry which is evicted by it
+    hpack::dynamic_table_t table(100, &resource);
+    table.add_entry("x-name", std::string(40, 'v'));
+    std::string_view name = table.get_entry(hpack::static_table_t::first_unused_index).name;
+    table.add_entry(name, std::string(50, 'w'));
+    error_if(table.get_entry(hpack::static_table_t::first_unused_index).name != "x-name");
+    error_if(table.current_size() != 6 + 50 + 32);
+  }
+  // deallocated with same sizes as allocated
+  error_if(resource.bytes_in_use != 0);
+}
+
+TEST(huffman_interleaved) {
+  std::mt19937 gen(777);
+  std::vector<std::string> strs;
+  std::vector<bytes_t> encoded;
+  for (int i = 0; i < 30; ++i) {
+    std::string& str = strs.emplace_back();
+    for (int j = rand_int(0, 200, gen); j > 0; --j)
+      str += char(rand_int(0, 255, gen));
+    bytes_t& bytes = encoded.emplace_back();
+    hpack::encode_string_huffman(str, std::back_inserter(bytes));
+    // skip length prefix
+    const auto* in = bytes.data();
+    auto len = hpack::decode_integer(in, in + bytes.size(), 7);
+    bytes.erase(bytes.begin(), bytes.begin() + (in - bytes.data()));
+    error_if(len != bytes.size());
+  }
+  for (size_t n = 1; n <= strs.size(); n += 4) {
+    std::vector<hpack::huffman_decode_job> jobs;
+    std::vector<std::string> outs(n);
+    for (size_t i = 0; i < n; ++i) {
+      outs[i].resize(hpack::max_huffman_string_size_after_decode(encoded[i].size()));
+      jobs.push_back({.in = encoded[i].data(), .len = hpack::size_type(encoded[i].size()), .out = outs[i].data()});
+    }
+    hpack::huffman_decode_interleaved(jobs);
+    for (size_t i = 0; i < n; ++i)
+      error_if(std::string_view(jobs[i].out, jobs[i].decoded_len) != strs[i]);
+  }
+}
+
+TEST(huffman_decode_eos) {
+  auto expect_error = [](auto&& f) {
+    try {
+      f();
+      error_if(true);
+    } catch (hpack::protocol_error&) {
+    }
+  };
+  // "a" (00011), EOS (30 ones), "a"
+  const bytes_t eos{0x1f, 0xff, 0xff, 0xff, 0xe3};
+  char out[16];
+  expect_error([&] { (void)hpack::huffman_decode(eos.data(), eos.size(), out); });
+  expect_error([&] { (void)hpack::huffman_decode(std::span(eos), std::span(out)); });
+  // small 'out', tail is decoded with bound checks
+  expect_error([&] { (void)hpack::huffman_decode(std::span(eos), std::span(out, 2)); });
+  expect_error([&] { (void)hpack::huffman_decoded_size(eos); });
+  // "1" (00001), EOS, "1"
+  const bytes_t eos_number{0x0f, 0xff, 0xff, 0xff, 0xe1};
+  uint64_t value;
+  expect_error([&] { (void)hpack::huffman_decode_number(eos_number.data(), eos_number.size(), value); });
+  bytes_t literal{0x85};
+  literal.insert(literal.end(), eos.begin(), eos.end());
+  const auto* in = literal.data();
+  hpack::decoded_string decoded;
+  expect_error([&] { hpack::decode_string(in, in + literal.size(), decoded); });
+  // EOS in each lane of interleaved decoding, other strings are shorter and longer
+  bytes_t short_str(hpack::huffman_encoded_size("abc"));
+  (void)hpack::huffman_encode("abc", short_str);
+  bytes_t long_str(hpack::huffman_encoded_size("abcdefghijklmnop"));
+  (void)hpack::huffman_encode("abcdefghijklmnop", long_str);
+  for (size_t n = 1; n <= 5; ++n) {
+    for (size_t bad = 0; bad < n; ++bad) {
+      std::vector<hpack::huffman_decode_job> jobs;
+      std::vector<std::string> outs(n, std::string(32, '\0'));
+      for (size_t i = 0; i < n; ++i) {
+        const bytes_t& b = i == bad ? eos : i % 2 ? short_str : long_str;
+        jobs.push_back({.in = b.data(), .len = hpack::size_type(b.size()), .out = outs[i].data()});
+      }
+      expect_error([&] { hpack::huffman_decode_interleaved(jobs); });
+    }
+  }
+}
+
+TEST(decode_block_interleaved) {
+  std::mt19937 gen(4242);
+  hpack::encoder enc(300);
+  hpack::decoder d1(300);
+  hpack::decoder d2(300);
+  hpack::block_decode_buffers buf;
+  for (int block = 0; block < 200; ++block) {
+    bytes_t bytes;
+    auto out = std::back_inserter(bytes);
+    if (block % 50 == 0)
+      enc.encode_dynamic_table_size_update(300, out);
+    for (int i = rand_int(1, 10, gen); i > 0; --i) {
+      std::string name = generate_random_string(rand_int(1, 5, gen), gen);
+      std::string value = generate_random_string(rand_int(0, 20, gen), gen);
+      switch (rand_int(0, 4, gen)) {
+        case 0:
+          enc.encode<true, true>(name, value, out);
+          break;
+        case 1:
+          enc.encode<true, false>(name, value, out);
+          break;
+        case 2:
+          enc.encode<false, true>(name, value, out);
+          break;
+        case 3:
+          enc.encode_header_never_indexing<true>(name, value, out);
+          break;
+        case 4:
+          enc.encode<true, true>(hpack::static_table_t::path, value, out);
+          break;
+      }
+    }
+    headers_t h1, h2;
+    hpack::decode_headers_block(d1, bytes, [&](std::string_view name, std::string_view value) {
+      h1.emplace_back(name, value);
+    });
+    hpack::decode_headers_block_interleaved(d2, bytes, buf, [&](std::string_view name, std::string_view value) {
+      h2.emplace_back(name, value);
+    });
+    error_if(h1 != h2);
+    error_if(d1.dyntab.current_size() != d2.dyntab.current_size());
+  }
+  // too big entry with name from dynamic table
+  {
+    hpack::encoder e(100);
+    hpack::decoder d(100);
+    bytes_t bytes;
+    e.encode_header_and_cache("name-x", "v", std::back_inserter(bytes));
+    e.encode_header_and_cache(62, std::string(200, 'v'), std::back_inserter(bytes));
+    headers_t h;
+    hpack::decode_headers_block_interleaved(d, bytes, buf, [&](std::string_view name, std::string_view value) {
+      h.emplace_back(name, value);
+    });
+    error_if(h.size() != 2 || h[1].first != "name-x" || h[1].second != std::string(200, 'v'));
+    error_if(d.dyntab.current_size() != 0);
+  }
+}
+
+TEST(decode_block_parallel) {
+  std::mt19937 gen(99);
+  hpack::encoder enc(8192);
+  hpack::decoder d1(8192);
+  hpack::decoder d2(8192);
+  hpack::block_decode_buffers buf;
+  hpack::parallel_decode_options opts{.min_bytes_per_task = 1024, .max_tasks = 4};
+  for (int block = 0; block < 5; ++block) {
+    bytes_t bytes;
+    for (int i = 0; i < 300; ++i) {
+      std::string name = "x-baggage-" + std::to_string(rand_int(0, 20, gen));
+      std::string value = generate_random_string(rand_int(0, 1000, gen), gen);
+      if (i % 3)
+        enc.encode<false, true>(name, value, std::back_inserter(bytes));
+      else
+        enc.encode<true, true>(name, value, std::back_inserter(bytes));
+    }
+    headers_t h1, h2;
+    hpack::decode_headers_block(d1, bytes, [&](std::string_view name, std::string_view value) {
+      h1.emplace_back(name, value);
+    });
+    hpack::decode_headers_block_parallel(
+        d2, bytes, buf, hpack::thread_parallel_for{},
+        [&](std::string_view name, std::string_view value) { h2.emplace_back(name, value); }, opts);
+    error_if(buf.task_bounds.size() != 5);
+    error_if(h1 != h2);
+    error_if(d1.dyntab.current_size() != d2.dyntab.current_size());
+  }
+  // protocol error in other thread
+  bytes_t bytes;
+  for (int i = 0; i < 100; ++i)
+    enc.encode_header_without_indexing<true>("x-big", std::string(100, 'a'), std::back_inserter(bytes));
+  // "a" with too long padding
+  bytes.insert(bytes.end(), {0x00, 0x05, 'x', '-', 'b', 'a', 'd', 0x82, 0x1f, 0xff});
+  try {
+    hpack::decode_headers_block_parallel(
+        d2, bytes, buf, hpack::thread_parallel_for{}, [](std::string_view, std::string_view) {}, opts);
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+}
+
+TEST(dynamic_table_introspection) {
+  hpack::encoder enc;
+  hpack::decoder dec;
+  bytes_t bytes;
+  auto out = std::back_inserter(bytes);
+  enc.encode<true>("x-churn", "1", out);
+  enc.encode<true>("x-stable", "abc", out);
+  for (int i = 0; i < 3; ++i)
+    enc.encode<true>("x-stable", "abc", out);
+  enc.encode<true>("x-churn", "2", out);
+  hpack::decode_headers_block(dec, bytes, [](std::string_view, std::string_view) {});
+
+  auto check = [](const auto* t) {
+    hpack::dyntab_snapshot s = t->snapshot();
+    error_if(s.entries.size() != 3 || s.insert_count != 3);
+    error_if(s.current_size != t->current_size());
+    // newest first
+    error_if(s.entries[0].name != "x-churn" || s.entries[0].value != "2" || s.entries[0].insert_number != 3);
+    error_if(s.entries[1].name != "x-stable" || s.entries[1].index != 63);
+    error_if(s.entries[1].hits < 3);
+    error_if(s.entries[2].size != 7 + 1 + 32);
+    hpack::dyntab_entry_stats st = t->entry_stats(63);
+    error_if(st.hits != s.entries[1].hits || st.name != "x-stable");
+    error_if(s.dump().find("[63] size 43, insert #2, hits ") == std::string::npos);
+  };
+  check(&enc.dyntab);
+  check(&dec.dyntab);
+  // decoder counts only index references
+  error_if(dec.dyntab.entry_stats(63).hits != 3);
+  // encoder: 3 fully indexed, churning header never found
+  error_if(enc.dyntab.entry_stats(63).hits != 3);
+  error_if(enc.dyntab.entry_stats(64).hits != 0);
+
+  // index after last entry
+  bytes.clear();
+  enc.encode_header_fully_indexed(61, out);
+  bytes.back() = 0x80 | 65;
+  try {
+    hpack::decode_headers_block(dec, bytes, [](std::string_view, std::string_view) {});
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+}
+
+TEST(decode_indexed_run) {
+  hpack::encoder enc;
+  bytes_t bytes;
+  auto out = std::back_inserter(bytes);
+  // 100 dynamic entries, so indexes >= 127 (multibyte) are possible too
+  for (int i = 0; i < 100; ++i)
+    enc.encode<true>("x-" + std::to_string(i), "v", out);
+  std::mt19937 gen(1234);
+  for (int i = 0; i < 500; ++i) {
+    hpack::index_type index = rand_int(1, enc.dyntab.current_max_index(), gen);
+    if (index < hpack::static_table_t::first_unused_index &&
+        hpack::static_table_t::get_entry(index).value.empty()) {
+      enc.encode_header_without_indexing(hpack::static_table_t::path, "/x", out);
+      continue;
+    }
+    enc.encode_header_fully_indexed(index, out);
+  }
+  headers_t expected;
+  hpack::decoder dec1;
+  hpack::header_view header;
+  for (const auto *in = bytes.data(), *e = in + bytes.size(); in != e;) {
+    dec1.decode_header(in, e, header);
+    expected.emplace_back(header.name.str(), header.value.str());
+  }
+  headers_t decoded;
+  hpack::decoder dec2;
+  hpack::decode_headers_block(dec2, bytes, [&](std::string_view name, std::string_view value) {
+    decoded.emplace_back(name, value);
+  });
+  error_if(decoded != expected);
+
+  auto expect_error = [](bytes_t b) {
+    hpack::decoder dec;
+    try {
+      hpack::decode_headers_block(dec, b, [](std::string_view, std::string_view) {});
+      error_if(true);
+    } catch (hpack::protocol_error&) {
+    }
+  };
+  // index 0
+  expect_error({0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x80});
+  // static entry without value
+  expect_error({0x82, 0x82, 0x81});
+  // empty dynamic table
+  expect_error({0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0xBE});
+  expect_error({0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0x82, 0xFF, 100});
+}
+
+TEST(encode_sequencer) {
+  constexpr uint32_t producers = 4;
+  constexpr uint32_t per_producer = 300;
+  // stream id = producer * per_producer + number
+  auto make_headers = [](uint32_t stream_id) {
+    hpack::encode_sequencer::header_list h;
+    h.emplace_back(":status", stream_id % 3 ? "200" : "404");
+    h.emplace_back("x-producer", std::to_string(stream_id / per_producer));
+    h.emplace_back("x-stream", std::to_string(stream_id));
+    return h;
+  };
+  hpack::encode_sequencer seq;
+  hpack::encoder enc;
+  hpack::decoder dec;
+  std::vector<uint32_t> last_seen(producers, 0);
+  size_t received = 0;
+  auto on_block = [&](uint32_t stream_id, std::span<const hpack::byte_t> block) {
+    headers_t decoded;
+    hpack::decode_headers_block(dec, block, [&](std::string_view name, std::string_view value) {
+      decoded.emplace_back(name, value);
+    });
+    hpack::encode_sequencer::header_list expected = make_headers(stream_id);
+    error_if(decoded != headers_t(expected.begin(), expected.end()));
+    // order of one producer preserved
+    uint32_t& last = last_seen[stream_id / per_producer];
+    error_if(stream_id % per_producer + 1 <= last);
+    last = stream_id % per_producer + 1;
+    ++received;
+  };
+  {
+    std::vector<std::jthread> threads;
+    for (uint32_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p] {
+        for (uint32_t i = 0; i < per_producer; ++i)
+          seq.submit(p * per_producer + i, make_headers(p * per_producer + i));
+      });
+    }
+    while (received != producers * per_producer)
+      seq.drain(enc, on_block);
+  }
+  error_if(seq.drain(enc, on_block) != 0);
+  error_if(!seq.empty());
+  // not drained submissions are freed by destructor
+  hpack::encode_sequencer seq2;
+  seq2.submit(1, make_headers(1));
+  // exception from 'on_block' is propagated, undelivered blocks are dropped
+  hpack::encode_sequencer seq3;
+  hpack::encoder enc3;
+  for (uint32_t i = 0; i < 3; ++i)
+    seq3.submit(i, make_headers(i));
+  size_t delivered = 0;
+  auto throwing = [&](uint32_t, std::span<const hpack::byte_t>) {
+    if (delivered == 1)
+      throw std::runtime_error("connection closed");
+    ++delivered;
+  };
+  try {
+    seq3.drain(enc3, throwing);
+    error_if(true);
+  } catch (std::runtime_error&) {
+  }
+  error_if(delivered != 1);
+  // all blocks were encoded before delivery, table of encoder is ahead of peer
+  error_if(!enc3.dyntab.find("x-stream", "2").value_indexed);
+  error_if(seq3.drain(enc3, throwing) != 0 || !seq3.empty());
+}
+
+TEST(shared_encoded_header) {
+  char date[29];
+  error_if(std::string_view(date, hpack::format_http_date(784111777, date)) != "Sun, 06 Nov 1994 08:49:37 GMT");
+  error_if(std::string_view(date, hpack::format_http_date(951782400, date)) != "Tue, 29 Feb 2000 00:00:00 GMT");
+
+  // same bytes as encoder produces, dynamic table not touched
+  hpack::shared_encoded_header h(hpack::static_table_t::server);
+  bytes_t bytes;
+  h.encode(std::back_inserter(bytes));
+  error_if(!bytes.empty());
+  error_if(!h.publish(5, "nginx"));
+  error_if(h.publish(5, "apache"));
+  error_if(h.publish(4, "apache"));
+  error_if(h.publish(6, std::string(200, 'x')));
+  error_if(h.tick() != 5);
+  h.encode(std::back_inserter(bytes));
+  hpack::encoder enc;
+  bytes_t expected;
+  enc.encode_header_without_indexing<true>(hpack::static_table_t::server, "nginx", std::back_inserter(expected));
+  error_if(bytes != expected);
+
+  bytes.clear();
+  hpack::encode_date_header(std::back_inserter(bytes));
+  hpack::decoder dec;
+  headers_t decoded;
+  hpack::decode_headers_block(dec, bytes, [&](std::string_view name, std::string_view value) {
+    decoded.emplace_back(name, value);
+  });
+  error_if(decoded.size() != 1 || decoded[0].first != "date" || decoded[0].second.size() != 29 ||
+           !decoded[0].second.ends_with(" GMT"));
+  error_if(dec.dyntab.current_size() != 0);
+
+  // readers always see consistent value
+  std::atomic_bool stop = false;
+  {
+    std::jthread writer([&] {
+      for (uint64_t tick = 6; !stop; ++tick)
+        (void)h.publish(tick, "value-" + std::string(tick % 50, 'a' + tick % 26));
+    });
+    for (int i = 0; i < 20000; ++i) {
+      bytes.clear();
+      h.encode(std::back_inserter(bytes));
+      hpack::decoder d;
+      hpack::decode_headers_block(d, bytes, [&](std::string_view name, std::string_view value) {
+        error_if(name != "server");
+        if (value == "nginx")  // writer not started yet
+          return;
+        error_if(!value.starts_with("value-"));
+        value.remove_prefix(6);
+        error_if(value.find_first_not_of(value.empty() ? 'a' : value[0]) != value.npos);
+      });
+    }
+    stop = true;
+  }
+}
+
+TEST(numeric_values) {
+  auto check = [](auto value, std::string_view name, bool huffman) {
+    hpack::encoder enc1, enc2;
+    bytes_t bytes, expected;
+    if (huffman) {
+      enc1.encode<false, true>(name, value, std::back_inserter(bytes));
+      enc2.encode<false, true>(name, std::to_string(value), std::back_inserter(expected));
+    } else {
+      enc1.encode(name, value, std::back_inserter(bytes));
+      enc2.encode(name, std::to_string(value), std::back_inserter(expected));
+    }
+    error_if(bytes != expected);
+    hpack::decoder dec;
+    hpack::header_view header;
+    const auto* in = bytes.data();
+    uint64_t decoded = dec.decode_header_number(in, in + bytes.size(), header);
+    error_if(decoded != value || header.name.str() != name || in != bytes.data() + bytes.size());
+  };
+  for (bool huffman : {false, true}) {
+    check(0u, "content-length", huffman);
+    check(200u, ":status", huffman);  // fully indexed
+    check(302u, ":status", huffman);
+    check(uint16_t(5), "grpc-status", huffman);
+    check(uint64_t(-1), "content-length", huffman);
+    check(1234567890ull, "x-offset", huffman);
+  }
+  // bool is not a number
+  auto encodable = []<typename T>(T) {
+    return requires(hpack::encoder& enc, T value, std::back_insert_iterator<bytes_t> out) {
+      enc.encode("x-flag", value, out);
+    };
+  };
+  static_assert(!encodable(true) && encodable(1u));
+  // cached, decoded value from dynamic table
+  {
+    hpack::encoder enc;
+    bytes_t bytes;
+    enc.encode<true, true>("content-length", 4096u, std::back_inserter(bytes));
+    enc.encode<true, true>("content-length", 4096u, std::back_inserter(bytes));
+    error_if(bytes.back() != 0xBE);
+    hpack::decoder dec;
+    hpack::header_view header;
+    const auto* in = bytes.data();
+    const auto* e = in + bytes.size();
+    error_if(dec.decode_header_number(in, e, header) != 4096);
+    error_if(dec.decode_header_number(in, e, header) != 4096 || header.name.str() != "content-length");
+  }
+  auto expect_error = [](std::string_view value, bool huffman) {
+    hpack::encoder enc;
+    bytes_t bytes;
+    if (huffman)
+      enc.encode_header_without_indexing<true>("content-length", value, std::back_inserter(bytes));
+    else
+      enc.encode_header_without_indexing("content-length", value, std::back_inserter(bytes));
+    hpack::decoder dec;
+    hpack::header_view header;
+    const auto* in = bytes.data();
+    try {
+      (void)dec.decode_header_number(in, in + bytes.size(), header);
+      error_if(true);
+    } catch (hpack::protocol_error&) {
+    }
+  };
+  for (bool huffman : {false, true}) {
+    expect_error("", huffman);
+    expect_error("12a", huffman);
+    expect_error("-1", huffman);
+    expect_error("+1", huffman);
+    expect_error("18446744073709551616", huffman);
+  }
+  // size update before status
+  {
+    hpack::encoder enc;
+    bytes_t bytes;
+    enc.encode_dynamic_table_size_update(100, std::back_inserter(bytes));
+    enc.encode<false, true>(hpack::static_table_t::status_200, 302u, std::back_inserter(bytes));
+    hpack::decoder dec;
+    const auto* in = bytes.data();
+    error_if(dec.decode_response_status(in, in + bytes.size()) != 302);
+    error_if(dec.dyntab.max_size() != 100);
+  }
+}
+
+TEST(decode_blocks_batch) {
+  constexpr size_t connections = 20;
+  std::mt19937 gen(4242);
+  std::vector<hpack::decoder> decoders(connections);
+  std::vector<hpack::decoder> expected_decoders(connections);
+  std::vector<hpack::encoder> encoders(connections);
+  for (int round = 0; round < 5; ++round) {
+    std::vector<bytes_t> blocks(connections);
+    std::vector<headers_t> expected(connections);
+    for (size_t c = 0; c < connections; ++c) {
+      // different count of headers, some connections have empty blocks
+      size_t count = rand_int(0, 30, gen);
+      for (size_t h = 0; h < count; ++h) {
+        std::string name = "x-" + std::to_string(rand_int(0, 10, gen));
+        std::string value = std::to_string(rand_int(0, 5, gen));
+        encoders[c].encode<true, true>(name, value, std::back_inserter(blocks[c]));
+      }
+      hpack::decode_headers_block(expected_decoders[c], blocks[c], [&](std::string_view n, std::string_view v) {
+        expected[c].emplace_back(n, v);
+      });
+    }
+    // corrupted block of one connection does not break others
+    if (round == 4)
+      blocks[3] = {0x80};
+    std::vector<hpack::batch_decode_item> items;
+    for (size_t c = 0; c < connections; ++c)
+      items.push_back({.dec = &decoders[c], .bytes = blocks[c]});
+    std::vector<headers_t> decoded(connections);
+    hpack::decode_headers_blocks_batch(items, [&](size_t c, std::string_view n, std::string_view v) {
+      decoded[c].emplace_back(n, v);
+    });
+    for (size_t c = 0; c < connections; ++c) {
+      if (round == 4 && c == 3) {
+        error_if(!items[c].error || !decoded[c].empty());
+        continue;
+      }
+      error_if(items[c].error);
+      error_if(decoded[c] != expected[c]);
+    }
+  }
+}
+
+TEST(hibernation) {
+  for (bool compress : {false, true}) {
+    hpack_test::counting_resource resource;
+    hpack::encoder enc(4096, &resource);
+    hpack::decoder dec(4096, &resource);
+    hpack::encoder enc2;
+    hpack::decoder dec2;
+    std::mt19937 gen(77);
+    auto exchange = [&](int count) {
+      headers_t headers;
+      for (int i = 0; i < count; ++i)
+        headers.emplace_back("x-" + std::to_string(rand_int(0, 40, gen)), "value-" + std::to_string(rand_int(0, 3, gen)));
+      bytes_t bytes, bytes2;
+      hpack::encode_headers_block<true, true>(enc, headers, std::back_inserter(bytes));
+      hpack::encode_headers_block<true, true>(enc2, headers, std::back_inserter(bytes2));
+      error_if(bytes != bytes2);
+      headers_t decoded, decoded2;
+      hpack::decode_headers_block(dec, bytes, [&](std::string_view n, std::string_view v) {
+        decoded.emplace_back(n, v);
+      });
+      hpack::decode_headers_block(dec2, bytes, [&](std::string_view n, std::string_view v) {
+        decoded2.emplace_back(n, v);
+      });
+      error_if(decoded != headers || decoded2 != headers);
+    };
+    exchange(100);
+    for (int round = 0; round < 10; ++round) {
+      std::string before = dec.dyntab.snapshot().dump();
+      size_t in_use = resource.bytes_in_use;
+      size_t allocated = dec.dyntab.allocated_bytes();
+      hpack::index_type max_index = dec.dyntab.current_max_index();
+      enc.hibernate(compress);
+      dec.hibernate(compress);
+      dec.hibernate(compress);  // nothing happens
+      error_if(!dec.dyntab.hibernated() || !enc.dyntab.hibernated());
+      error_if(resource.bytes_in_use >= in_use);
+      error_if(dec.dyntab.allocated_bytes() >= allocated);
+      error_if(dec.dyntab.current_max_index() != max_index);
+      // read without waking: snapshot from packed content, no entries
+      error_if(dec.dyntab.snapshot().dump() != before);
+      error_if(dec.dyntab.get_entry(max_index) || dec.dyntab.entry_stats(max_index).index != 0);
+      error_if(!dec.dyntab.hibernated());
+      if (round == 0) {
+        dec.wake();
+        error_if(dec.dyntab.hibernated());
+        error_if(dec.dyntab.snapshot().dump() != before);
+      }
+      exchange(round + 1);
+      error_if(enc.dyntab.hibernated() || dec.dyntab.hibernated());
+    }
+    error_if(enc.dyntab.snapshot().dump() != enc2.dyntab.snapshot().dump());
+    error_if(dec.dyntab.snapshot().dump() != dec2.dyntab.snapshot().dump());
+    // reset and destruction of hibernated table
+    dec.hibernate(compress);
+    dec.dyntab.reset();
+    error_if(dec.dyntab.hibernated() || dec.dyntab.current_size() != 0);
+    enc.hibernate(compress);
+    hpack::encoder moved = std::move(enc);
+    error_if(!moved.dyntab.hibernated());
+  }
+}
+
+TEST(archive) {
+  std::mt19937 gen(88);
+  std::vector<headers_t> records;
+  size_t text_size = 0;
+  for (int i = 0; i < 1000; ++i) {
+    headers_t& h = records.emplace_back();
+    h.emplace_back(":method", i % 3 ? "GET" : "POST");
+    h.emplace_back(":path", "/api/" + std::to_string(rand_int(0, 20, gen)));
+    h.emplace_back("user-agent", "curl/8.5.0");
+    h.emplace_back("x-request-id", std::to_string(gen()));
+    if (i % 10 == 0)
+      h.emplace_back("cookie", generate_random_string(rand_int(0, 200, gen), gen));
+    for (auto& [n, v] : h)
+      text_size += n.size() + v.size() + 4;
+  }
+  for (bool huffman : {false, true}) {
+    bytes_t file;
+    auto sink = [&](std::span<const hpack::byte_t> b) { file.insert(file.end(), b.begin(), b.end()); };
+    hpack::archive_writer writer(sink, {.table_size = 16 * 1024,
+                                        .records_per_segment = 64,
+                                        .seed = {{"user-agent", "curl/8.5.0"}, {"x-request-id", ""}},
+                                        .huffman = huffman});
+    for (auto& h : records)
+      writer.add(h);
+    writer.finish();
+    error_if(file.size() * 2 > text_size);
+
+    hpack::archive_reader reader(file);
+    error_if(reader.records_count() != records.size());
+    error_if(reader.segments_count() != (records.size() + 63) / 64);
+    hpack::decoder dec;
+    std::vector<headers_t> decoded(records.size());
+    reader.read_all(dec, [&](uint64_t r, std::string_view n, std::string_view v) {
+      decoded[r].emplace_back(n, v);
+    });
+    error_if(decoded != records);
+    for (uint64_t r : {0, 63, 64, 500, 999}) {
+      headers_t one;
+      reader.read_record(r, dec, [&](std::string_view n, std::string_view v) { one.emplace_back(n, v); });
+      error_if(one != records[r]);
+    }
+    // table of reused decoder is reset, not recreated: vector of entries is not reallocated
+    hpack_test::counting_resource resource;
+    hpack::decoder reused(16 * 1024, &resource);
+    auto ignore = [](uint64_t, std::string_view, std::string_view) {};
+    reader.read_segment(0, reused, ignore);
+    const size_t first_read = resource.allocated.count;
+    resource.reset_stats();
+    reader.read_segment(0, reused, ignore);
+    error_if(resource.allocated.count >= first_read);
+    // broken files
+    for (size_t len : {size_t(0), size_t(10), file.size() / 2, file.size() - 1}) {
+      try {
+        hpack::archive_reader broken(std::span(file.data(), len));
+        error_if(true);
+      } catch (hpack::protocol_error&) {
+      }
+    }
+  }
+  bytes_t empty;
+  hpack::archive_writer writer(
+      [&](std::span<const hpack::byte_t> b) { empty.insert(empty.end(), b.begin(), b.end()); });
+  writer.finish();
+  hpack::archive_reader reader(empty);
+  error_if(reader.records_count() != 0 || reader.segments_count() != 0);
+}
+
+// bit by bit, as specified in RFC
+static bytes_t reference_huffman_encode(std::string_view str) {
+  bytes_t out;
+  int bitn = 0;
+  auto push_bit = [&](bool bit) {
+    if (bitn == 0)
+      out.push_back(0);
+    out.back() |= bit << (7 - bitn);
+    bitn = (bitn + 1) % 8;
+  };
+  for (char c : str) {
+    hpack::sym_info_t info = hpack::huffman_table[uint8_t(c)];
+    for (int i = 0; i < info.bit_count; ++i)
+      push_bit(info.bits & (1 << i));
+  }
+  while (bitn != 0)
+    push_bit(true);
+  return out;
+}
+
+TEST(huffman_encode_identical) {
+  std::mt19937 gen(89);
+  using path_t = hpack::noexport::huffman_encode_path;
+  std::vector<path_t> paths;
+  for (path_t path : {path_t::scalar, path_t::avx2}) {
+    if (hpack::noexport::huffman_encode_path_supported(path))
+      paths.push_back(path);
+  }
+  for (size_t len = 0; len < 300; ++len) {
+    for (int rep = 0; rep < 4; ++rep) {
+      std::string str(len, '\0');
+      // all bytes, only control chars (codes of 23-30 bits) and short codes
+      const int64_t min_c = rep < 2 ? 0 : '0';
+      const int64_t max_c = rep == 0 ? 255 : rep == 1 ? 31 : 'z';
+      for (char& c : str)
+        c = char(rand_int(min_c, max_c, gen));
+      bytes_t expected = reference_huffman_encode(str);
+      // pointer and iterator outputs
+      bytes_t ptr_out(hpack::max_huffman_chunk_size(len) + 16);
+      hpack::byte_t* e = hpack::encode_string_huffman(str, ptr_out.data());
+      ptr_out.resize(e - ptr_out.data());
+      bytes_t it_out;
+      hpack::encode_string_huffman(str, std::back_inserter(it_out));
+      error_if(ptr_out != it_out);
+      const auto* in = it_out.data();
+      error_if(hpack::decode_integer(in, in + it_out.size(), 7) != expected.size());
+      error_if(bytes_t(in, std::as_const(it_out).data() + it_out.size()) != expected);
+      // each implementation, nothing is written after encoded string
+      for (path_t path : paths) {
+        bytes_t out(hpack::max_huffman_chunk_size(len) + 4, 0xAA);
+        hpack::huffman_encoder_state state;
+        hpack::byte_t* e = hpack::noexport::huffman_encode_chunk(str, state, out.data(), path);
+        e = hpack::huffman_encode_finish(state, e);
+        error_if(bytes_t(out.data(), e) != expected);
+        error_if(std::any_of(e, out.data() + out.size(), [](hpack::byte_t b) { return b != 0xAA; }));
+      }
+    }
+  }
+  // incremental encoding by arbitrary chunks gives same bytes, also when implementations are mixed
+  for (size_t mode = 0; mode <= paths.size(); ++mode) {
+    std::string str = generate_random_string(1000, gen);
+    hpack::huffman_encoder_state state;
+    bytes_t out(hpack::max_huffman_chunk_size(str.size()) + 4);
+    hpack::byte_t* it = out.data();
+    for (size_t i = 0; i < str.size();) {
+      size_t n = rand_int(0, 100, gen);
+      path_t path = mode < paths.size() ? paths[mode] : paths[rand_int(0, paths.size() - 1, gen)];
+      it = hpack::noexport::huffman_encode_chunk(std::string_view(str).substr(i, n), state, it, path);
+      i += n;
+    }
+    it = hpack::huffman_encode_finish(state, it);
+    out.resize(it - out.data());
+    error_if(out != reference_huffman_encode(str));
+  }
+}
+
+TEST(header_fingerprint) {
+  std::mt19937 gen(92);
+  headers_t request = {
+      {":method", "GET"},
+      {":path", "/index.html"},
+      {"accept-encoding", "gzip, deflate, br"},
+      {"accept-language", "en-US"},
+      {"user-agent", generate_random_string(40, gen)},
+      {"accept-encoding", "identity"},
+  };
+  hpack::header_fingerprint vary{"Accept-Encoding", "accept-language"};
+  hpack::header_fingerprint all;
+  error_if(!vary.selects("accept-language") || vary.selects("accept") || vary.selects(":path"));
+  // unsorted and repeated names in any case
+  hpack::header_fingerprint many{"X-B", "cookie", "x-a", "Accept", "x-c", "x-a", "ACCEPT"};
+  for (std::string_view name : {"x-a", "x-b", "x-c", "cookie", "accept"})
+    error_if(!many.selects(name));
+  for (std::string_view name : {"x-d", "x-", "accept-language", "cookiE", ""})
+    error_if(many.selects(name));
+
+  for (bool huffman : {false, true}) {
+    hpack::encoder enc;
+    hpack::decoder dec;
+    // second block uses dynamic table
+    for (int i = 0; i < 2; ++i) {
+      bytes_t bytes;
+      if (huffman)
+        hpack::encode_headers_block<true, true>(enc, request, std::back_inserter(bytes));
+      else
+        hpack::encode_headers_block<true, false>(enc, request, std::back_inserter(bytes));
+      headers_t decoded;
+      uint64_t fp = hpack::decode_headers_block_fingerprint(
+          dec, bytes, vary, [&](std::string_view n, std::string_view v) { decoded.emplace_back(n, v); });
+      error_if(decoded != request);
+      error_if(fp != vary.of(request));
+    }
+  }
+  // order of headers and not selected headers do not matter
+  headers_t other = request;
+  std::reverse(other.begin(), other.end());
+  other[1].second = "another agent";
+  error_if(other[1].first != "user-agent");
+  error_if(vary.of(other) != vary.of(request));
+  error_if(all.of(other) == all.of(request));
+  // repeated and changed values matter
+  other.emplace_back("accept-language", "en-US");
+  error_if(vary.of(other) == vary.of(request));
+  other.pop_back();
+  other[2].second = "en-GB";
+  error_if(vary.of(other) == vary.of(request));
+  // lengths are hashed
+  error_if(all.of(headers_t{{"ab", "c"}}) == all.of(headers_t{{"a", "bc"}}));
+  error_if(all.of(headers_t{}) == all.of(headers_t{{"", ""}}));
+  error_if(hpack::header_fingerprint(1).of(request) == hpack::header_fingerprint(2).of(request));
+}
+
+TEST(huffman_codec_api) {
+  std::mt19937 gen(93);
+  for (int i = 0; i < 1000; ++i) {
+    std::string str = i % 2 ? generate_random_string(rand_int(0, 300, gen), gen) : std::to_string(gen());
+    if (i % 3 == 0)
+      for (char& c : str)
+        c = char(gen());
+    // without string length prefix
+    bytes_t expected;
+    hpack::encode_string<true>(str, std::back_inserter(expected));
+    hpack::In prefix_end = expected.data();
+    (void)hpack::decode_integer(prefix_end, expected.data() + expected.size(), 7);
+    expected.erase(expected.begin(), expected.begin() + (prefix_end - expected.data()));
+
+    error_if(hpack::huffman_encoded_size(str) != expected.size());
+    // exact size, guard bytes must not be touched
+    bytes_t encoded(expected.size() + 8, 0xAA);
+    auto written = hpack::huffman_encode(str, std::span(encoded).first(expected.size()));
+    error_if(!std::equal(written.begin(), written.end(), expected.begin(), expected.end()));
+    error_if(std::count(encoded.begin() + expected.size(), encoded.end(), 0xAA) != 8);
+
+    error_if(hpack::huffman_decoded_size(expected) != str.size());
+    std::string decoded(str.size() + 8, '\xAA');
+    auto chars = hpack::huffman_decode(expected, std::span(decoded).first(str.size()));
+    error_if(std::string_view(chars.data(), chars.size()) != str);
+    error_if(std::count(decoded.begin() + str.size(), decoded.end(), '\xAA') != 8);
+    std::string big(hpack::max_huffman_string_size_after_decode(expected.size()), '\0');
+    chars = hpack::huffman_decode(expected, big);
+    error_if(std::string_view(chars.data(), chars.size()) != str);
+    if (!str.empty()) {
+      try {
+        (void)hpack::huffman_decode(expected, std::span(decoded).first(str.size() - 1));
+        error_if(true);
+      } catch (hpack::protocol_error&) {
+      }
+    }
+  }
+  // incorrect padding (zeros)
+  bytes_t bad = {0x00};
+  try {
+    (void)hpack::huffman_decoded_size(bad);
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+}
+
+template <bool Cache, bool Huffman>
+static void check_encode_chunked(std::string_view name, const std::vector<std::string_view>& chunks,
+                                 hpack::size_type table_size) {
+  std::string value;
+  for (std::string_view c : chunks)
+    value += c;
+  hpack::encoder enc1(table_size);
+  hpack::encoder enc2(table_size);
+  enc1.dyntab.add_entry("x-before", "1");
+  enc2.dyntab.add_entry("x-before", "1");
+  bytes_t chunked;
+  enc1.encode_chunked<Cache, Huffman>(name, chunks, std::back_inserter(chunked));
+  // same as concatenated value
+  bytes_t expected;
+  hpack::index_type name_index = hpack::static_table_t::find(name);
+  const bool cached = Cache && name.size() + value.size() + 32 <= table_size;
+  if (cached && name_index)
+    enc2.encode_header_and_cache<Huffman>(name_index, value, std::back_inserter(expected));
+  else if (cached)
+    enc2.encode_header_and_cache<Huffman>(name, value, std::back_inserter(expected));
+  else if (name_index)
+    enc2.encode_header_without_indexing<Huffman>(name_index, value, std::back_inserter(expected));
+  else
+    enc2.encode_header_without_indexing<Huffman>(name, value, std::back_inserter(expected));
+  error_if(chunked != expected);
+  error_if(enc1.dyntab.snapshot().dump() != enc2.dyntab.snapshot().dump());
+  // too big value does not evict table
+  error_if(enc1.dyntab.current_size() == 0);
+
+  hpack::decoder dec(table_size);
+  dec.dyntab.add_entry("x-before", "1");
+  headers_t decoded;
+  hpack::decode_headers_block(dec, chunked,
+                              [&](std::string_view n, std::string_view v) { decoded.emplace_back(n, v); });
+  error_if(decoded != headers_t{{std::string(name), value}});
+}
+
+TEST(encode_chunked) {
+  std::mt19937 gen(94);
+  for (int i = 0; i < 100; ++i) {
+    std::string value = generate_random_string(rand_int(0, 3000, gen), gen);
+    std::vector<std::string_view> chunks;
+    for (size_t pos = 0; pos < value.size();) {
+      size_t n = std::min<size_t>(rand_int(0, 200, gen), value.size() - pos);
+      chunks.push_back(std::string_view(value).substr(pos, n));
+      pos += n;
+    }
+    std::string_view name = i % 2 ? "set-cookie" : "x-baggage";
+    hpack::size_type table_size = i % 3 ? 4096 : 1024;
+    check_encode_chunked<false, false>(name, chunks, table_size);
+    check_encode_chunked<false, true>(name, chunks, table_size);
+    check_encode_chunked<true, false>(name, chunks, table_size);
+    check_encode_chunked<true, true>(name, chunks, table_size);
+  }
+}
+
+TEST(connection_context) {
+  std::mt19937 gen(95);
+  hpack_test::counting_resource upstream;
+  {
+    hpack::connection_context client(
+        {.encoder_table_size = 4096, .decoder_table_size = 8192, .upstream = &upstream});
+    hpack::connection_context server(
+        {.encoder_table_size = 8192, .decoder_table_size = 4096, .upstream = &upstream});
+    // slabs only
+    error_if(upstream.allocated.count != 2);
+    error_if(upstream.bytes_in_use != client.slab_size() + server.slab_size());
+    bytes_t block;
+    auto exchange_blocks = [&](int count) {
+      for (int i = 0; i < count; ++i) {
+        headers_t request{
+            {":method", "GET"},
+            {":path", "/item/" + std::to_string(rand_int(0, 1000, gen))},
+            {"user-agent", "load/1.0"},
+            {"x-request-id", generate_random_string(rand_int(8, 40, gen), gen)},
+        };
+        if (i % 7 == 0)
+          request.emplace_back("cookie", generate_random_string(rand_int(100, 1500, gen), gen));
+        for (auto* c : {&client, &server}) {
+          auto* peer = c == &client ? &server : &client;
+          block.clear();
+          hpack::encode_headers_block<true, true>(c->enc, request, std::back_inserter(block));
+          headers_t decoded;
+          peer->decode_block(block,
+                             [&](std::string_view n, std::string_view v) { decoded.emplace_back(n, v); });
+          error_if(decoded != request);
+        }
+      }
+    };
+    exchange_blocks(2000);
+    // churn of tables did not leave slabs
+    error_if(upstream.allocated.count != 2);
+    // idle connections, woken up by next blocks
+    for (auto* c : {&client, &server}) {
+      c->enc.hibernate(true);
+      c->dec.hibernate();
+    }
+    exchange_blocks(1000);
+    error_if(client.enc.dyntab.hibernated() || server.dec.dyntab.hibernated());
+    error_if(upstream.allocated.count != 2);
+  }
+  // teardown is one free per connection
+  error_if(upstream.deallocations != 2 || upstream.bytes_in_use != 0);
+}
+
+TEST(no_heap) {
+  std::mt19937 gen(96);
+  // corpus prepared before measuring: many names and sizes, entries bigger than table
+  std::vector<headers_t> corpus;
+  for (int i = 0; i < 3000; ++i) {
+    headers_t& request = corpus.emplace_back();
+    request.emplace_back(":method", i % 5 ? "GET" : "POST");
+    request.emplace_back(":path", "/item/" + std::to_string(rand_int(0, 1000, gen)));
+    request.emplace_back("user-agent", "load/1.0");
+    for (int j = rand_int(0, 8, gen); j > 0; --j) {
+      request.emplace_back("x-h" + std::to_string(rand_int(0, 50, gen)),
+                           generate_random_string(rand_int(0, 120, gen), gen));
+    }
+    if (i % 7 == 0)
+      request.emplace_back("cookie", generate_random_string(rand_int(100, 3000, gen), gen));
+    if (i % 101 == 0)
+      request.emplace_back("x-too-big", generate_random_string(5000, gen));
+  }
+  hpack_test::counting_resource upstream;
+  hpack::connection_context_options opts{
+      .encoder_table_size = 4096, .decoder_table_size = 4096, .upstream = &upstream, .no_heap = true};
+  hpack::connection_context client(opts);
+  hpack::connection_context server(opts);
+  error_if(upstream.allocated.count != 2);
+  bytes_t block(opts.max_block_size);
+  size_t mismatches = 0;
+  {
+    hpack_test::malloc_scope mallocs;
+    for (const headers_t& request : corpus) {
+      for (auto* c : {&client, &server}) {
+        auto* peer = c == &client ? &server : &client;
+        auto* e = hpack::encode_headers_block<true, true>(c->enc, request, block.data());
+        size_t i = 0;
+        peer->decode_block(std::span(block.data(), e), [&](std::string_view n, std::string_view v) {
+          mismatches += i >= request.size() || request[i].first != n || request[i].second != v;
+          ++i;
+        });
+        mismatches += i != request.size();
+      }
+    }
+    if constexpr (hpack_test::malloc_counting_supported())
+      error_if(mallocs.get().count != 0);
+  }
+  error_if(mismatches != 0);
+  error_if(upstream.allocated.count != 2);
+  // limits exceeded: size error, not allocation
+  bytes_t too_long(opts.max_block_size + 1, 0x82);
+  try {
+    (void)server.decode_block(too_long, [](std::string_view, std::string_view) {});
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+  bytes_t too_many(opts.max_block_headers + 1, 0x82);
+  try {
+    (void)server.decode_block(too_many, [](std::string_view, std::string_view) {});
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+  size_t decoded = 0;
+  (void)server.decode_block(std::span(too_many).subspan(1),
+                            [&](std::string_view, std::string_view) { ++decoded; });
+  error_if(decoded != opts.max_block_headers);
+  error_if(upstream.allocated.count != 2);
+  // hibernation is size error, tables stay usable
+  auto hibernate_fails = [](auto& ctx) {
+    try {
+      ctx.hibernate();
+      error_if(true);
+    } catch (hpack::protocol_error&) {
+    }
+    error_if(ctx.dyntab.hibernated());
+  };
+  hibernate_fails(client.enc);
+  hibernate_fails(server.dec);
+  {
+    hpack_test::malloc_scope mallocs;
+    const headers_t& request = corpus.front();
+    auto* e = hpack::encode_headers_block<true, true>(client.enc, request, block.data());
+    size_t i = 0;
+    (void)server.decode_block(std::span(block.data(), e), [&](std::string_view n, std::string_view v) {
+      mismatches += i >= request.size() || request[i].first != n || request[i].second != v;
+      ++i;
+    });
+    mismatches += i != request.size();
+    if constexpr (hpack_test::malloc_counting_supported())
+      error_if(mallocs.get().count != 0);
+  }
+  error_if(mismatches != 0);
+  error_if(upstream.allocated.count != 2);
+}
+
+TEST(learned_policy) {
+  std::mt19937 gen(97);
+  auto binary = [&] {
+    std::string str;
+    for (int i = 0; i < 20; ++i)
+      str += char(rand_int(128, 255, gen));
+    return str;
+  };
+  auto make_request = [&] {
+    return headers_t{
+        {":method", "GET"},
+        {"user-agent", "load/1.0"},
+        {"x-request-id", generate_random_string(24, gen)},
+        {"x-token", binary()},
+    };
+  };
+  hpack::learned_policy_cache cache(2);
+  hpack::learned_policy first({.min_samples = 8});
+  hpack::encoder enc;
+  hpack::decoder dec;
+  bytes_t block;
+  for (int i = 0; i < 50; ++i) {
+    headers_t request = make_request();
+    block.clear();
+    hpack::encode_headers_block_learned(enc, first, request, std::back_inserter(block));
+    headers_t decoded;
+    hpack::decode_headers_block(dec, block, [&](std::string_view n, std::string_view v) {
+      decoded.emplace_back(n, v);
+    });
+    error_if(decoded != request);
+  }
+  // constant value indexed, volatile values are not, huffman only where it helps
+  error_if(!first.decision_for("user-agent").index || !first.decision_for("user-agent").huffman);
+  error_if(first.decision_for("x-request-id").index || !first.decision_for("x-request-id").huffman);
+  error_if(first.decision_for("x-token").index || first.decision_for("x-token").huffman);
+  error_if(first.stats_of("x-request-id")->seen != 50 || first.stats_of("x-request-id")->repeats != 0);
+  // huffman measured for first 'min_samples' values, then for each 16th (16, 32, 48)
+  error_if(first.stats_of("x-request-id")->huffman_samples != 8 + 3);
+  error_if(first.stats_of("unknown") != nullptr);
+  // hex ids compress, but not much
+  hpack::learned_policy strict({.min_huffman_saving_percent = 40});
+  hpack::learned_policy relaxed;
+  for (int i = 0; i < 20; ++i) {
+    std::string id = std::to_string(gen()) + "deadbeef";
+    (void)strict.observe("x-id", id);
+    (void)relaxed.observe("x-id", id);
+  }
+  error_if(strict.decision_for("x-id").huffman || !relaxed.decision_for("x-id").huffman);
+  // table holds only repeated headers (and volatile of first requests, before enough samples)
+  error_if(enc.dyntab.current_max_index() - hpack::static_table_t::first_unused_index + 1 > 20);
+
+  // next connection to same peer uses learned stats from first request
+  cache.store("peer-a", first);
+  cache.store("peer-b", hpack::learned_policy_snapshot{});
+  error_if(cache.size() != 2);
+  hpack::learned_policy second;
+  error_if(!cache.load("peer-a", second));
+  error_if(second.names_count() != first.names_count());
+  hpack::encoder enc2;
+  block.clear();
+  hpack::encode_headers_block_learned(enc2, second, make_request(), std::back_inserter(block));
+  // only user-agent inserted
+  error_if(enc2.dyntab.current_max_index() != hpack::static_table_t::first_unused_index);
+  error_if(enc2.dyntab.get_entry(hpack::static_table_t::first_unused_index).name != "user-agent");
+
+  // bounded, least recently used dropped ("peer-a" used by load)
+  cache.store("peer-c", second);
+  error_if(cache.size() != 2);
+  hpack::learned_policy third({.max_names = 2});
+  error_if(cache.load("peer-b", third));
+  error_if(!cache.load("peer-c", third));
+  error_if(third.names_count() != 2);
+  cache.erase("peer-a");
+  error_if(cache.load("peer-a", third) || cache.size() != 1);
+}
+
+TEST(encode_effort) {
+  using enum hpack::encode_effort;
+  headers_t request{
+      {":method", "GET"},
+      {":path", "/index.html"},
+      {"user-agent", "Mozilla/5.0 (X11; Linux x86_64)"},
+      {"cookie", std::string(1000, 'c')},
+  };
+  size_t sizes[4];
+  for (hpack::encode_effort effort : {static_only, no_huffman, balanced, max}) {
+    hpack::effort_controller controller(effort);
+    hpack::encoder enc;
+    hpack::decoder dec;
+    bytes_t block;
+    for (int i = 0; i < 2; ++i) {
+      block.clear();
+      hpack::encode_headers_block_adaptive(enc, request, std::back_inserter(block), controller);
+      headers_t decoded;
+      hpack::decode_headers_block(dec, block, [&](std::string_view n, std::string_view v) {
+        decoded.emplace_back(n, v);
+      });
+      error_if(decoded != request);
+    }
+    sizes[size_t(effort)] = block.size();
+    const size_t entries = enc.dyntab.current_max_index() - hpack::static_table_t::first_unused_index + 1;
+    // balanced does not index big cookie
+    error_if(entries != (effort == static_only ? 0 : effort == balanced ? 1 : 2));
+  }
+  // repeated block is smaller with more effort
+  error_if(sizes[size_t(no_huffman)] >= sizes[size_t(static_only)]);
+  error_if(sizes[size_t(max)] != 4);
+
+  hpack::effort_controller controller(max, {.high_load_percent = 80, .low_load_percent = 50});
+  error_if(controller.report_load(90) != balanced);
+  error_if(controller.report_load(95) != no_huffman);
+  // between thresholds level is kept
+  error_if(controller.report_load(70) != no_huffman);
+  error_if(controller.report_load(90) != static_only);
+  error_if(controller.report_load(100) != static_only);
+  error_if(controller.report_load(10) != no_huffman);
+  controller.set(max);
+  error_if(controller.report_load(0) != max || controller.get() != max);
+  error_if(&hpack::global_effort_controller() != &hpack::global_effort_controller());
+}
+
+TEST(decode_pipeline) {
+  std::mt19937 gen(100);
+  std::vector<headers_t> requests;
+  std::vector<bytes_t> blocks;
+  {
+    hpack::encoder enc(1024);
+    for (int i = 0; i < 3000; ++i) {
+      headers_t& request = requests.emplace_back(headers_t{
+          {":method", "GET"},
+          {":path", "/item/" + std::to_string(rand_int(0, 100, gen))},
+          {"user-agent", "load/1.0"},
+          {"x-request-id", generate_random_string(rand_int(8, 40, gen), gen)},
+      });
+      if (i % 7 == 0)
+        request.emplace_back("cookie", generate_random_string(rand_int(100, 1500, gen), gen));
+      bytes_t& block = blocks.emplace_back();
+      if (i % 100 == 0)
+        enc.encode_dynamic_table_size_update(1024, std::back_inserter(block));
+      // volatile headers are not indexed, their huffman strings are decoded by consumer
+      for (auto& [name, value] : request) {
+        if (name == "x-request-id" || name == "cookie")
+          enc.encode<false, true>(name, value, std::back_inserter(block));
+        else
+          enc.encode<true, true>(name, value, std::back_inserter(block));
+      }
+    }
+  }
+  hpack::decode_pipeline pipeline(8);
+  error_if(pipeline.capacity() != 8);
+  hpack::decoder dec(1024);
+  std::thread io([&] {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      while (!pipeline.try_push(dec, uint32_t(i * 2 + 1), blocks[i]))
+        std::this_thread::yield();
+    }
+  });
+  size_t popped = 0;
+  size_t mismatches = 0;
+  while (popped < blocks.size()) {
+    bool ok = pipeline.try_pop([&](uint32_t stream_id, std::span<const hpack::table_entry> headers) {
+      const headers_t& expected = requests[popped];
+      mismatches += stream_id != popped * 2 + 1 || headers.size() != expected.size();
+      for (size_t j = 0; j < std::min(headers.size(), expected.size()); ++j)
+        mismatches += headers[j].name != expected[j].first || headers[j].value != expected[j].second;
+      ++popped;
+    });
+    if (!ok)
+      std::this_thread::yield();
+  }
+  io.join();
+  error_if(mismatches != 0);
+  error_if(pipeline.size() != 0);
+
+  // full queue, block is not consumed
+  hpack::decode_pipeline small(1);
+  bytes_t indexed{0x82, 0x84};
+  error_if(!small.try_push(dec, 1, indexed));
+  error_if(small.try_push(dec, 3, indexed));
+  error_if(!small.try_pop([](uint32_t, std::span<const hpack::table_entry>) {}));
+  error_if(!small.try_push(dec, 3, indexed));
+  (void)small.try_pop([](uint32_t, std::span<const hpack::table_entry>) {});
+
+  // uppercase name is reported by consumer, slot is released
+  bytes_t upper;
+  hpack::encoder enc;
+  enc.encode_header_without_indexing<true>("X-Upper", "v", std::back_inserter(upper));
+  error_if(!small.try_push(dec, 5, upper));
+  try {
+    (void)small.try_pop([](uint32_t, std::span<const hpack::table_entry>) {});
+    error_if(true);
+  } catch (hpack::protocol_error&) {
+  }
+  error_if(small.size() != 0);
+}
+
 int main() {
   test_decoded_string();
   test_tg_answer();
@@ -690,4 +2056,28 @@ int main() {
   test_decode_status();
   test_dynamic_table_size_update();
   test_static_table_find_by_index();
+  test_allocation_budgets();
+  test_huffman_padding();
+  test_dynamic_table_add_evicted_name();
+  test_huffman_interleaved();
+  test_huffman_decode_eos();
+  test_decode_block_interleaved();
+  test_decode_block_parallel();
+  test_dynamic_table_introspection();
+  test_decode_indexed_run();
+  test_encode_sequencer();
+  test_shared_encoded_header();
+  test_numeric_values();
+  test_decode_blocks_batch();
+  test_hibernation();
+  test_archive();
+  test_huffman_encode_identical();
+  test_header_fingerprint();
+  test_huffman_codec_api();
+  test_encode_chunked();
+  test_connection_context();
+  test_no_heap();
+  test_learned_policy();
+  test_encode_effort();
+  test_decode_pipeline();
 }